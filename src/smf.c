@@ -85,6 +85,7 @@ smf_file_new(void)
 
 	memset(smf, 0, sizeof(SmfFile));
 	smf->ref_count = 1;
+	smf->timeline_position = -1;
 
 	smf->tracks_array = g_ptr_array_new_with_free_func(
 		(GDestroyNotify)smf_track_unref);
@@ -152,10 +153,29 @@ smf_file_unref(SmfFile *smf)
 		g_ptr_array_free(smf->tracks_array, TRUE);
 		g_ptr_array_free(smf->tempo_array, TRUE);
 
+		if (smf->next_event_heap != NULL)
+			g_ptr_array_free(smf->next_event_heap, TRUE);
+
+		if (smf->timeline != NULL)
+			g_array_free(smf->timeline, TRUE);
+
+		if (smf->mapped_file != NULL)
+			g_mapped_file_unref(smf->mapped_file);
+
 		free(smf);
 	}
 }
 
+/*
+ * Frees entries of events_array, which are %NULL for events of compacted tracks that were not created yet.
+ */
+static void
+unref_event_if_any(gpointer event)
+{
+	if (event != NULL)
+		smf_event_unref(event);
+}
+
 /**
  * smf_track_new:
  *
@@ -176,13 +196,146 @@ smf_track_new(void)
 	track->ref_count = 1;
 	track->next_event_number = -1;
 
-	track->events_array = g_ptr_array_new_with_free_func(
-		(GDestroyNotify)smf_event_unref);
+	track->events_array = g_ptr_array_new_with_free_func(unref_event_if_any);
 	assert(track->events_array);
 
 	return (track);
 }
 
+/*
+ * Internal:
+ *
+ * Makes room for "number_of_events" events in the empty track, so that appending
+ * them does not need to grow events_array over and over.
+ */
+void
+smf_track_reserve_events(SmfTrack *track, int number_of_events)
+{
+	assert(track->events_array->len == 0);
+
+	if (number_of_events <= 0)
+		return;
+
+	g_ptr_array_unref(track->events_array);
+	track->events_array = g_ptr_array_new_full(number_of_events, unref_event_if_any);
+	assert(track->events_array);
+}
+
+/*
+ * Internal:
+ *
+ * Returns entry "index" of events_array, skipping the gap; %NULL if the track is compacted and
+ * the event was not created yet.
+ */
+smf_event_t *
+smf_track_event_at(const smf_track_t *track, int index)
+{
+	if (index >= track->gap_start)
+		index += track->gap_length;
+
+	return (g_ptr_array_index(track->events_array, index));
+}
+
+/*
+ * Moves the gap of events_array so that it starts at "index", clearing entries that end up
+ * in the gap.  Takes time proportional to the distance.
+ */
+static void
+move_gap(SmfTrack *track, int index)
+{
+	gpointer *pdata = track->events_array->pdata;
+	int gap_start = track->gap_start, gap_length = track->gap_length, first_stale;
+
+	if (gap_length > 0 && index < gap_start) {
+		memmove(pdata + index + gap_length, pdata + index, (gap_start - index) * sizeof(*pdata));
+		memset(pdata + index, 0, MIN(gap_start - index, gap_length) * sizeof(*pdata));
+	} else if (gap_length > 0 && index > gap_start) {
+		memmove(pdata + gap_start, pdata + gap_start + gap_length, (index - gap_start) * sizeof(*pdata));
+		first_stale = MAX(gap_start + gap_length, index);
+		memset(pdata + first_stale, 0, (index + gap_length - first_stale) * sizeof(*pdata));
+	}
+
+	track->gap_start = index;
+}
+
+/*
+ * Removes the gap, so that events_array can be accessed directly again.
+ */
+static void
+close_gap(SmfTrack *track)
+{
+	if (track->gap_length == 0)
+		return;
+
+	move_gap(track, track->number_of_events);
+	track->gap_length = 0;
+
+	/* Entries past the end are all in the gap, i.e. %NULL, so this does not unref anything. */
+	g_ptr_array_set_size(track->events_array, track->number_of_events);
+}
+
+/*
+ * Puts the event at "index" of events_array, using the gap.  When there is no gap left, makes
+ * a new one, proportional to the size of the track, so that moving the following events
+ * is paid for by many insertions.
+ */
+static void
+insert_into_gap(SmfTrack *track, int index, SmfEvent *event)
+{
+	int old_length, grow;
+	gpointer *pdata;
+
+	move_gap(track, index);
+
+	if (track->gap_length == 0) {
+		old_length = track->events_array->len;
+		grow = MAX(16, track->number_of_events / 8);
+
+		g_ptr_array_set_size(track->events_array, old_length + grow);
+		pdata = track->events_array->pdata;
+		memmove(pdata + index + grow, pdata + index, (old_length - index) * sizeof(*pdata));
+		memset(pdata + index, 0, MIN(old_length - index, grow) * sizeof(*pdata));
+
+		track->gap_length = grow;
+	}
+
+	g_ptr_array_index(track->events_array, track->gap_start) = event;
+	track->gap_start++;
+	track->gap_length--;
+}
+
+/*
+ * Takes the event at "index" out of events_array, growing the gap, without dropping the reference
+ * that events_array held.
+ */
+static void
+remove_into_gap(SmfTrack *track, int index)
+{
+	move_gap(track, index);
+
+	g_ptr_array_index(track->events_array, index + track->gap_length) = NULL;
+	track->gap_length++;
+}
+
+/*
+ * Frees columns created by smf_track_compact().  "columns" may be NULL.
+ */
+static void
+free_event_columns(struct smf_event_columns *columns)
+{
+	if (columns == NULL)
+		return;
+
+	free(columns->time_pulses);
+	free(columns->time_seconds);
+	free(columns->length);
+	free(columns->status);
+	free(columns->data);
+	free(columns->payload_offset);
+	free(columns->payload);
+	free(columns);
+}
+
 /**
  * smf_track_delete:
  * @track: (transfer full): the track to delete
@@ -235,6 +388,7 @@ smf_track_unref(smf_track_t *track)
 
 	if (g_atomic_int_dec_and_test (&track->ref_count)) {
 		g_ptr_array_free(track->events_array, TRUE);
+		free_event_columns(track->columns);
 		memset(track, 0, sizeof(smf_track_t));
 		free(track);
 	}
@@ -246,12 +400,16 @@ smf_track_unref(smf_track_t *track)
  * @smf: the smf to add @track to
  * @track: (transfer full): track to be added to @smf
  *
- * Appends @track to @smf.
+ * Appends @track to @smf.  If @track has events already, e.g. it was made by smf_track_clone(),
+ * their times in seconds get recomputed, and so does the tempo map, if there are tempo changes
+ * or time signatures among them.
  */
 void
 smf_file_add_track(SmfFile *smf, SmfTrack *track)
 {
-	int cantfail;
+	int cantfail, i;
+	SmfEvent view;
+	const SmfEvent *event;
 
 	assert(track->smf == NULL);
 
@@ -262,6 +420,29 @@ smf_file_add_track(SmfFile *smf, SmfTrack *track)
 	track->track_number = smf->number_of_tracks;
 	assert(smf->number_of_tracks == smf->tracks_array->len);
 
+	smf_file_track_length_changed(smf, -1, smf_track_length_pulses(track));
+	smf->next_event_heap_valid = 0;
+	smf->timeline_valid = 0;
+	smf->timeline_position = -1;
+
+	/*
+	 * Track that already has events, e.g. one removed from another song or made by smf_track_clone(),
+	 * has their ->time_seconds computed using some other tempo map, and its tempo changes are not
+	 * in this one.
+	 */
+	if (track->number_of_events > 0 && !track->events_pending) {
+		smf_track_compute_seconds(track);
+
+		for (i = 1; i <= track->number_of_events; i++) {
+			event = smf_track_get_event_view(track, i, &view);
+
+			if (smf_event_is_tempo_change_or_time_signature(event)) {
+				smf_file_invalidate_tempo_map(smf, event->time_pulses);
+				break;
+			}
+		}
+	}
+
 	if (smf->number_of_tracks > 1) {
 		cantfail = smf_set_format(smf, 1);
 		assert(!cantfail);
@@ -280,38 +461,55 @@ smf_file_add_track(SmfFile *smf, SmfTrack *track)
 void
 smf_file_remove_track(smf_t *smf, smf_track_t *track)
 {
-	int i, j;
+	int i;
 	SmfTrack *tmp;
-	SmfEvent *ev;
 
 	assert(smf != NULL);
 
 	assert(smf->tracks_array);
+
+	/* Removing it from tracks_array drops the reference held by the smf; we still need it for a while. */
+	track = smf_track_ref(track);
+
+	/*
+	 * Events of a lazily loaded track cannot be parsed once it leaves its smf.  No need to bother
+	 * if the track is about to be freed, though, i.e. the only other reference is the smf's one.
+	 */
+	if (track->events_pending && g_atomic_int_get(&track->ref_count) > 2)
+		smf_track_load_pending_events(track);
+
+	track->chunk_length = 0;
+
+	/* Outside of the smf, the track is not part of the edit anymore. */
+	close_gap(track);
+
 	if (!g_ptr_array_remove(smf->tracks_array, track)) {
 	    g_critical("Track %d not found in song.", track->track_number);
+	    smf_track_unref(track);
 	    return;
 	}
 
 	smf->number_of_tracks--;
 	assert(smf->number_of_tracks == smf->tracks_array->len);
 
-	/* Renumber the rest of the tracks, so they are consecutively numbered. */
+	smf_file_track_length_changed(smf, smf_track_length_pulses(track), -1);
+	smf->next_event_heap_valid = 0;
+	smf->timeline_valid = 0;
+	smf->timeline_position = -1;
+
+	/*
+	 * Renumber the rest of the tracks, so they are consecutively numbered.  Events have track numbers
+	 * too, but these get updated only when the event is accessed; see smf_event_get_track_number().
+	 */
 	for (i = track->track_number; i <= smf->number_of_tracks; i++) {
-		tmp = smf_get_track_by_number(smf, i);
+		tmp = g_ptr_array_index(smf->tracks_array, i - 1);
 		tmp->track_number = i;
-
-		/*
-		 * Events have track numbers too.  I guess this wasn't a wise
-		 * decision.  ;-/
-		 */
-		for (j = 1; j <= tmp->number_of_events; j++) {
-			ev = smf_track_get_event_by_number(tmp, j);
-			ev->track_number = i;
-		}
 	}
 
 	track->track_number = -1;
 	track->smf = NULL;
+
+	smf_track_unref(track);
 }
 
 /**
@@ -327,6 +525,315 @@ smf_track_remove_from_smf(smf_track_t *track)
 	smf_file_remove_track(track->smf, track);
 }
 
+/*
+ * Block of memory events are carved from by smf_arena_alloc().
+ */
+struct arena_block {
+	struct arena_block	*previous;
+};
+
+#define ARENA_ROUND(size)	(((size) + SMF_ARENA_ALIGNMENT - 1) & ~(size_t)(SMF_ARENA_ALIGNMENT - 1))
+#define ARENA_MAX_BLOCK_SIZE	(1024 * 1024)
+
+/*
+ * Internal:
+ *
+ * Creates new arena.  "size_hint" is the size of the first block; pass expected total
+ * size of allocations, if known, or 0.
+ */
+smf_arena_t *
+smf_arena_new(size_t size_hint)
+{
+	smf_arena_t *arena = malloc(sizeof(smf_arena_t));
+	if (arena == NULL) {
+		g_critical("Cannot allocate smf_arena_t structure: %s", strerror(errno));
+		return (NULL);
+	}
+
+	memset(arena, 0, sizeof(smf_arena_t));
+
+	arena->ref_count = 1;
+	arena->block_size = MAX(ARENA_ROUND(size_hint), 4096);
+
+	return (arena);
+}
+
+/*
+ * Internal:
+ */
+smf_arena_t *
+smf_arena_ref(smf_arena_t *arena)
+{
+	g_atomic_int_inc(&arena->ref_count);
+	return (arena);
+}
+
+/*
+ * Internal:
+ *
+ * Frees all the memory allocated from the arena at once, when the last reference goes away.
+ */
+void
+smf_arena_unref(smf_arena_t *arena)
+{
+	struct arena_block *block, *previous;
+
+	if (!g_atomic_int_dec_and_test(&arena->ref_count))
+		return;
+
+	for (block = arena->last_block; block != NULL; block = previous) {
+		previous = block->previous;
+		free(block);
+	}
+
+	free(arena);
+}
+
+/*
+ * Internal:
+ *
+ * Returns "size" bytes of uninitialized memory, valid until the arena is freed.  There is no way
+ * to free it earlier.  Arena is not locked; only one thread at a time may allocate from it.
+ */
+void *
+smf_arena_alloc(smf_arena_t *arena, size_t size)
+{
+	size_t block_size;
+	struct arena_block *block;
+	void *ptr;
+
+	size = ARENA_ROUND(size);
+
+	if (arena->next == NULL || arena->next + size > arena->end) {
+		block_size = MAX(arena->block_size, size);
+
+		block = malloc(ARENA_ROUND(sizeof(struct arena_block)) + block_size);
+		if (block == NULL) {
+			g_critical("Cannot allocate arena block: %s", strerror(errno));
+			return (NULL);
+		}
+
+		block->previous = arena->last_block;
+		arena->last_block = block;
+		arena->next = (unsigned char *)block + ARENA_ROUND(sizeof(struct arena_block));
+		arena->end = arena->next + block_size;
+
+		/* Unknown number of allocations to come; grow, but not without bound. */
+		arena->block_size = MIN(arena->block_size * 2, ARENA_MAX_BLOCK_SIZE);
+	}
+
+	ptr = arena->next;
+	arena->next += size;
+
+	return (ptr);
+}
+
+/*
+ * Internal:
+ *
+ * Same as smf_event_new(), but the event is allocated from the arena, along with room for "length" bytes
+ * for midi_buffer, which is set to point at it.  Short messages go into the inline buffer, as usual.
+ * Such an event holds a reference to the arena.  Its midi_buffer may still be replaced with malloc(3)ed
+ * one, just like with any other event.
+ */
+smf_event_t *
+smf_event_new_from_arena(smf_arena_t *arena, int length)
+{
+	smf_event_t *event;
+	int trailing_length;
+
+	assert(length >= 0);
+
+	trailing_length = length > SMF_EVENT_INLINE_BUFFER_SIZE ? length : 0;
+
+	event = smf_arena_alloc(arena, sizeof(smf_event_t) + trailing_length);
+	if (event == NULL)
+		return (NULL);
+
+	memset(event, 0, sizeof(smf_event_t));
+
+	event->ref_count = 1;
+	event->delta_time_pulses = -1;
+	event->time_pulses = -1;
+	event->time_seconds = -1.0;
+	event->track_number = -1;
+	event->arena = smf_arena_ref(arena);
+
+	if (trailing_length > 0)
+		event->midi_buffer = (unsigned char *)(event + 1);
+	else if (length > 0)
+		event->midi_buffer = event->inline_buffer;
+
+	event->midi_buffer_length = length;
+
+	return (event);
+}
+
+/*
+ * Internal:
+ *
+ * Makes event->midi_buffer point to room for "length" bytes - the inline buffer, if they fit
+ * there, or newly malloc(3)ed memory otherwise - and sets event->midi_buffer_length.  Returns 0
+ * iff everything went OK.
+ */
+int
+smf_event_allocate_buffer(smf_event_t *event, int length)
+{
+	assert(event->midi_buffer == NULL);
+	assert(length > 0);
+
+	event->midi_buffer_length = length;
+
+	if (length <= SMF_EVENT_INLINE_BUFFER_SIZE) {
+		event->midi_buffer = event->inline_buffer;
+		return (0);
+	}
+
+	event->midi_buffer = malloc(length);
+	if (event->midi_buffer == NULL) {
+		g_critical("Cannot allocate MIDI buffer structure: %s", strerror(errno));
+		event->midi_buffer_length = 0;
+
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Events freed by smf_event_unref() are kept for reuse by smf_event_new(), up to this many per thread.
+ * Messages up to SMF_EVENT_INLINE_BUFFER_SIZE bytes don't allocate anything else, so creating and
+ * destroying them is allocation-free in steady state.
+ */
+#define EVENT_FREELIST_MAX_LENGTH	1024
+
+struct event_freelist {
+	struct freed_event	*first;
+	int			length;
+};
+
+/* Reuses the memory of the event while it is on the freelist. */
+struct freed_event {
+	struct freed_event	*next;
+};
+
+#ifdef HAVE_TLS
+/* Same as g_private_get(&event_freelist_key), only faster. */
+static __thread struct event_freelist *thread_event_freelist;
+#endif
+
+static void
+event_freelist_free(gpointer data)
+{
+	struct event_freelist *freelist = data;
+	struct freed_event *freed;
+
+#ifdef HAVE_TLS
+	thread_event_freelist = NULL;
+#endif
+
+	while (freelist->first != NULL) {
+		freed = freelist->first;
+		freelist->first = freed->next;
+		free(freed);
+	}
+
+	g_free(freelist);
+}
+
+/* Freelists are per thread, so no locking is needed; cached events are freed when the thread exits. */
+static GPrivate event_freelist_key = G_PRIVATE_INIT(event_freelist_free);
+
+static struct event_freelist *
+get_event_freelist(void)
+{
+	struct event_freelist *freelist;
+
+#ifdef HAVE_TLS
+	if (thread_event_freelist != NULL)
+		return (thread_event_freelist);
+#endif
+
+	freelist = g_private_get(&event_freelist_key);
+
+	if (freelist == NULL) {
+		freelist = g_new0(struct event_freelist, 1);
+		g_private_set(&event_freelist_key, freelist);
+	}
+
+#ifdef HAVE_TLS
+	thread_event_freelist = freelist;
+#endif
+
+	return (freelist);
+}
+
+/*
+ * Returns memory for SmfEvent, from the freelist of the calling thread, if possible.
+ */
+static SmfEvent *
+event_alloc(void)
+{
+	struct event_freelist *freelist = get_event_freelist();
+	struct freed_event *freed = freelist->first;
+
+	if (freed == NULL)
+		return (malloc(sizeof(SmfEvent)));
+
+	freelist->first = freed->next;
+	freelist->length--;
+
+	return ((SmfEvent *)freed);
+}
+
+/*
+ * Puts the event onto the freelist of the calling thread or, if it is full, frees it.  No need
+ * to clear the event in the former case; smf_event_new() does that anyway.
+ */
+static void
+event_free(SmfEvent *event)
+{
+	struct event_freelist *freelist = get_event_freelist();
+	struct freed_event *freed = (struct freed_event *)event;
+
+	if (freelist->length >= EVENT_FREELIST_MAX_LENGTH) {
+		memset(event, 0, sizeof(SmfEvent));
+		free(event);
+		return;
+	}
+
+	freed->next = freelist->first;
+	freelist->first = freed;
+	freelist->length++;
+}
+
+/**
+ * smf_trim_event_cache:
+ * @max_cached_events: number of events to keep
+ *
+ * Events freed by smf_event_unref() are cached, so that creating new ones doesn't need to
+ * allocate memory.  Every thread has its own cache, holding up to 1024 events.  This frees
+ * memory of the cached events of the calling thread, except for @max_cached_events of them.
+ * Cached events are freed anyway when the thread exits.
+ *
+ * Since: 1.4
+ */
+void
+smf_trim_event_cache(int max_cached_events)
+{
+	struct event_freelist *freelist = g_private_get(&event_freelist_key);
+	struct freed_event *freed;
+
+	if (freelist == NULL)
+		return;
+
+	while (freelist->length > MAX(max_cached_events, 0)) {
+		freed = freelist->first;
+		freelist->first = freed->next;
+		freelist->length--;
+		free(freed);
+	}
+}
 
 /**
  * smf_event_new:
@@ -340,7 +847,7 @@ smf_track_remove_from_smf(smf_track_t *track)
 SmfEvent *
 smf_event_new(void)
 {
-	SmfEvent *event = malloc(sizeof(SmfEvent));
+	SmfEvent *event = event_alloc();
 	if (event == NULL) {
 		g_critical("Cannot allocate SmfEvent structure: %s", strerror(errno));
 		return (NULL);
@@ -377,10 +884,7 @@ smf_event_new_from_pointer(void *midi_data, int len)
 	if (event == NULL)
 		return (NULL);
 
-	event->midi_buffer_length = len;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate MIDI buffer structure: %s", strerror(errno));
+	if (smf_event_allocate_buffer(event, len)) {
 		smf_event_delete(event);
 
 		return (NULL); 
@@ -473,10 +977,7 @@ smf_event_new_from_bytes(int first_byte, int second_byte, int third_byte)
 		}
 	}
 
-	event->midi_buffer_length = len;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate MIDI buffer structure: %s", strerror(errno));
+	if (smf_event_allocate_buffer(event, len)) {
 		smf_event_delete(event);
 
 		return (NULL); 
@@ -526,13 +1027,48 @@ smf_event_ref(SmfEvent *event)
     return event;
 }
 
-/**
- * smf_event_unref:
- * @event: (transfer full): the event to unref
- *
- * Unref the event and free its memory if this is the last reference.
- *
- * Since: 1.4
+/*
+ * Returns 1 if event->midi_buffer points into the mapping of the file the event was loaded from,
+ * i.e. it is not ours to free(3).  Applications are free to replace such buffer with malloc(3)ed one.
+ */
+int
+smf_event_buffer_is_mapped(const SmfEvent *event)
+{
+	const unsigned char *contents;
+
+	if (event->mapped_file == NULL || event->midi_buffer == NULL)
+		return (0);
+
+	contents = (const unsigned char *)g_mapped_file_get_contents(event->mapped_file);
+
+	if (event->midi_buffer >= contents &&
+	    event->midi_buffer < contents + g_mapped_file_get_length(event->mapped_file))
+		return (1);
+
+	return (0);
+}
+
+/*
+ * Internal:
+ *
+ * Returns 1 iff event->midi_buffer is the one allocated right behind the event by smf_event_new_from_arena().
+ */
+int
+smf_event_buffer_is_in_arena(const SmfEvent *event)
+{
+	if (event->arena == NULL)
+		return (0);
+
+	return (event->midi_buffer == (const unsigned char *)(event + 1));
+}
+
+/**
+ * smf_event_unref:
+ * @event: (transfer full): the event to unref
+ *
+ * Unref the event and free its memory if this is the last reference.
+ *
+ * Since: 1.4
  */
 void
 smf_event_unref(SmfEvent *event)
@@ -540,13 +1076,22 @@ smf_event_unref(SmfEvent *event)
 	g_return_if_fail (event);
 
 	if (g_atomic_int_dec_and_test (&event->ref_count)) {
-		if (event->midi_buffer != NULL) {
+		if (event->midi_buffer != NULL && event->midi_buffer != event->inline_buffer &&
+		    !smf_event_buffer_is_mapped(event) && !smf_event_buffer_is_in_arena(event)) {
 			memset(event->midi_buffer, 0, event->midi_buffer_length);
 			free(event->midi_buffer);
 		}
 
-		memset(event, 0, sizeof(smf_event_t));
-		free(event);
+		if (event->mapped_file != NULL)
+			g_mapped_file_unref(event->mapped_file);
+
+		/* Memory of the event goes away along with the rest of the arena. */
+		if (event->arena != NULL) {
+			smf_arena_unref(event->arena);
+			return;
+		}
+
+		event_free(event);
 	}
 }
 
@@ -570,489 +1115,1882 @@ smf_event_get_buffer(SmfEvent *event, int *length)
 }
 
 /*
- * Used for sorting track->events_array.
+ * Marks the track as being in use and parses its events, if it was loaded by smf_file_load_lazy()
+ * and that did not happen yet.
  */
-static gint
-events_array_compare_function(gconstpointer aa, gconstpointer bb)
+static void
+touch_track(const SmfTrack *track)
 {
-	SmfEvent *a, *b;
-	
-	/* "The comparison function for g_ptr_array_sort() doesn't take the pointers
-	    from the array as arguments, it takes pointers to the pointers in the array." */
-	a = (SmfEvent *)*(gpointer *)aa;
-	b = (SmfEvent *)*(gpointer *)bb;
+	SmfTrack *tmp = (SmfTrack *)track;
 
-	if (a->time_pulses < b->time_pulses)
-		return (-1);
+	tmp->events_touched = 1;
 
-	if (a->time_pulses > b->time_pulses)
-		return (1);
+	if (tmp->events_pending)
+		smf_track_load_pending_events(tmp);
+}
 
-	/*
-	 * We need to preserve original order, otherwise things will break
-	 * when there are several events with the same ->time_pulses.
-	 * XXX: This is an ugly hack; we should remove sorting altogether.
-	 */
+/*
+ * Returns ->time_pulses of the event, without creating it if the track is compacted.
+ */
+static int
+event_time_pulses(const SmfTrack *track, int event_number)
+{
+	if (track->columns != NULL)
+		return (track->columns->time_pulses[event_number - 1]);
 
-	if (a->event_number < b->event_number)
-		return (-1);
+	return (smf_track_event_at(track, event_number - 1)->time_pulses);
+}
 
-	if (a->event_number > b->event_number)
-		return (1);
+/*
+ * Returns ->time_seconds of the event, without creating it if the track is compacted.
+ */
+static double
+event_time_seconds(const SmfTrack *track, int event_number)
+{
+	/* Stored ->time_seconds might be out of date, or not stored at all. */
+	if (track->smf != NULL && track->smf->lazy_seconds)
+		return (seconds_from_pulses(track->smf, event_time_pulses(track, event_number)));
 
-	return (0);
+	if (track->columns != NULL)
+		return (track->columns->time_seconds[event_number - 1]);
+
+	return (smf_track_event_at(track, event_number - 1)->time_seconds);
 }
 
 /*
- * An assumption here is that if there is an EOT event, it will be at the end of the track.
+ * Internal:
+ *
+ * Returns number of the first event in the track that happens at "pulses" - or "seconds", if "pulses"
+ * is negative - or later, or -1 if there is no such event.  Binary search; events are ordered by time.
  */
-static void
-remove_eot_if_before_pulses(SmfTrack *track, int pulses)
+int
+smf_track_find_first_event_at_or_after(const SmfTrack *track, int pulses, double seconds)
 {
-	SmfEvent *event;
+	int low = 1, high = track->number_of_events + 1, middle;
 
-	event = smf_track_get_last_event(track);
+	touch_track(track);
 
-	if (event == NULL)
-		return;
+	while (low < high) {
+		middle = low + (high - low) / 2;
 
-	if (!smf_event_is_eot(event))
-		return;
+		if (pulses >= 0 ? event_time_pulses(track, middle) < pulses : event_time_seconds(track, middle) < seconds)
+			low = middle + 1;
+		else
+			high = middle;
+	}
 
-	if (event->time_pulses > pulses)
-		return;
+	if (low > track->number_of_events)
+		return (-1);
 
-	smf_track_remove_event(track, event);
+	return (low);
 }
 
-/**
- * smf_track_add_event:
- * @track: The track
- * @event: event to add to the track
- *
- * Adds the event to the track and computes ->delta_pulses.  Note that it is faster
- * to append events to the end of the track than to insert them in the middle.
- * Usually you want to use smf_track_add_event_seconds or smf_track_add_event_pulses
- * instead of this one.  Event needs to have ->time_pulses and ->time_seconds already set.
- * If you try to add event after an EOT, EOT event will be automatically deleted.
+/*
+ * Returns next event from the track and advances next event counter, like smf_track_get_next_event(),
+ * but leaves smf->next_event_heap alone; it is up to the caller to keep it in order.
  */
-void
-smf_track_add_event(SmfTrack *track, SmfEvent *event)
+static SmfEvent *
+advance_track(SmfTrack *track)
 {
-	int i, last_pulses = 0;
-
-	assert(track->smf != NULL);
-	assert(event->track == NULL);
-	assert(event->delta_time_pulses == -1);
-	assert(event->time_pulses >= 0);
-	assert(event->time_seconds >= 0.0);
-
-	remove_eot_if_before_pulses(track, event->time_pulses);
+	SmfEvent *event;
 
-	event->track = track;
-	event->track_number = track->track_number;
+	touch_track(track);
 
-	if (track->number_of_events == 0) {
-		assert(track->next_event_number == -1);
-		track->next_event_number = 1;
-	}
+	/* End of track? */
+	if (track->next_event_number == -1)
+		return (NULL);
 
-	if (track->number_of_events > 0)
-		last_pulses = smf_track_get_last_event(track)->time_pulses;
+	assert(track->next_event_number >= 1);
+	assert(track->number_of_events > 0);
 
-	track->number_of_events++;
+	event = smf_track_get_event_by_number(track, track->next_event_number);
 
-	/* Are we just appending element at the end of the track? */
-	if (last_pulses <= event->time_pulses) {
-		event->delta_time_pulses = event->time_pulses - last_pulses;
-		assert(event->delta_time_pulses >= 0);
-		g_ptr_array_add(track->events_array, event);
-		event->event_number = track->number_of_events;
+	assert(event != NULL);
 
-	/* We need to insert in the middle of the track.  XXX: This is slow. */
+	/* Is this the last event in the track? */
+	if (track->next_event_number < track->number_of_events) {
+		track->time_of_next_event = event_time_pulses(track, track->next_event_number + 1);
+		track->next_event_number++;
 	} else {
-		/* Append, then sort according to ->time_pulses. */
-		g_ptr_array_add(track->events_array, event);
-		g_ptr_array_sort(track->events_array, events_array_compare_function);
-
-		/* Renumber entries and fix their ->delta_pulses. */
-		for (i = 1; i <= track->number_of_events; i++) {
-			SmfEvent *tmp = smf_track_get_event_by_number(track, i);
-			tmp->event_number = i;
-
-			if (tmp->delta_time_pulses != -1)
-				continue;
-
-			if (i == 1) {
-				tmp->delta_time_pulses = tmp->time_pulses;
-			} else {
-				tmp->delta_time_pulses = tmp->time_pulses -
-					smf_track_get_event_by_number(track, i - 1)->time_pulses;
-				assert(tmp->delta_time_pulses >= 0);
-			}
-		}
-
-		/* Adjust ->delta_time_pulses of the next event. */
-		if (event->event_number < track->number_of_events) {
-			SmfEvent *next_event = smf_track_get_event_by_number(track, event->event_number + 1);
-			assert(next_event);
-			assert(next_event->time_pulses >= event->time_pulses);
-			next_event->delta_time_pulses -= event->delta_time_pulses;
-			assert(next_event->delta_time_pulses >= 0);
-		}
+		track->next_event_number = -1;
 	}
 
-	if (smf_event_is_tempo_change_or_time_signature(event)) {
-		if (smf_event_is_last(event))
-			maybe_add_to_tempo_map(event);
-		else
-			smf_file_create_tempo_map_and_compute_seconds(event->track->smf);
-	}
+	return (event);
 }
 
 /**
- * smf_track_add_eot_delta_pulses:
+ * smf_track_get_next_event:
  * @track: the track
- * @delta: delta
  *
- * Add End Of Track metaevent.  Using it is optional, libsmf will automatically
- * add EOT to the tracks during smf_file_save(), with delta_pulses 0.  If you try to add EOT
- * in the middle of the track, it will fail and nonzero value will be returned.
- * If you try to add EOT after another EOT event, it will be added, but the existing
- * EOT event will be removed.
+ * Returns next event from the track given and advances next event counter.
+ * Do not depend on End Of Track event being the last event on the track - it
+ * is possible that the track will not end with EOT if you haven't added it
+ * yet.  EOTs are added automatically during smf_file_save().
  *
- * Returns: 0 if everything went ok, nonzero otherwise.
+ * Returns: #SmfEvent or %NULL, if there are no more events left in this track.
  */
-int
-smf_track_add_eot_delta_pulses(SmfTrack *track, int delta)
+SmfEvent *
+smf_track_get_next_event(SmfTrack *track)
 {
-	SmfEvent *event;
-
-	event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
-	if (event == NULL)
-		return (-1);
+	SmfEvent *event = advance_track(track);
 
-	smf_track_add_event_delta_pulses(track, event, delta);
+	smf_track_position_changed(track);
 
-	return (0);
+	return (event);
 }
 
 /**
- * smf_track_add_eot_pulses:
+ * smf_track_peek_next_event:
  * @track: the track
- * @pulses: pulses
  *
- * Returns: 0 if everything went ok, nonzero otherwise.
+ * Returns next event from the track given.  Does not change next event counter,
+ * so repeatedly calling this routine will return the same event.
+ *
+ * Returns: #SmfEvent or %NULL, if there are no more events left in this track.
  */
-int
-smf_track_add_eot_pulses(SmfTrack *track, int pulses)
+static SmfEvent *
+smf_track_peek_next_event(SmfTrack *track)
 {
-	SmfEvent *event, *last_event;
+	SmfEvent *event;
 
-	last_event = smf_track_get_last_event(track);
-	if (last_event != NULL) {
-		if (last_event->time_pulses > pulses)
-			return (-2);
-	}
+	/* End of track? */
+	if (track->next_event_number == -1)
+		return (NULL);
 
-	event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
-	if (event == NULL)
-		return (-3);
+	assert(track->next_event_number >= 1);
+	assert(track->events_array->len != 0);
 
-	smf_track_add_event_pulses(track, event, pulses);
+	event = smf_track_get_event_by_number(track, track->next_event_number);
 
-	return (0);
+	return (event);
 }
 
 /**
- * smf_track_add_eot_seconds:
- * @track: the track
- * @seconds: seconds
+ * smf_file_get_track_by_number:
+ * @smf: the SMF
+ * @track_number: number of track to get
  *
- * Returns: 0 if everything went ok, nonzero otherwise.
+ * Returns: Track with a given number or NULL, if there is no such track.
+ *          Tracks are numbered consecutively starting from one.
  */
-int
-smf_track_add_eot_seconds(SmfTrack *track, double seconds)
+SmfTrack *
+smf_file_get_track_by_number(const SmfFile *smf, int track_number)
 {
-	SmfEvent *event, *last_event;
+	SmfTrack *track;
 
-	last_event = smf_track_get_last_event(track);
-	if (last_event != NULL) {
-		if (last_event->time_seconds > seconds)
-			return (-2);
-	}
+	assert(track_number >= 1);
 
-	event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
-	if (event == NULL)
-		return (-1);
+	if (track_number > smf->number_of_tracks)
+		return (NULL);
 
-	smf_track_add_event_seconds(track, event, seconds);
+	track = (SmfTrack *)g_ptr_array_index(smf->tracks_array, track_number - 1);
 
-	return (0);
+	assert(track);
+
+	touch_track(track);
+
+	return (track);
 }
 
-/**
- * smf_track_remove_event:
- * @track: track to remove @event from
- * @event: the event to remove
- *
- * Detaches @event from @track
- *
- * Since: 1.4
+/*
+ * Returns index of the first event in the track that happens after "pulses", or number of events
+ * if there is no such event.
  */
-void
-smf_track_remove_event(smf_track_t *track, smf_event_t *event)
+static int
+find_first_event_after_pulses(const SmfTrack *track, int pulses)
 {
-	int i, was_last;
-	SmfEvent *tmp;
+	int event_number = smf_track_find_first_event_at_or_after(track, pulses + 1, 0.0);
 
-	assert(track != NULL);
-	assert(track->smf != NULL);
-
-	was_last = smf_event_is_last(event);
+	if (event_number == -1)
+		return (track->number_of_events);
 
-	/* Adjust ->delta_time_pulses of the next event. */
-	if (event->event_number < track->number_of_events) {
-		tmp = smf_track_get_event_by_number(track, event->event_number + 1);
-		assert(tmp);
-		tmp->delta_time_pulses += event->delta_time_pulses;
-	}
+	return (event_number - 1);
+}
 
-	track->number_of_events--;
-	g_ptr_array_remove(track->events_array, event);
+/*
+ * Returns index of the event in events_array, or -1 if it is not there.  Usually ->event_number
+ * is still right; if not, it is found using binary search on ->time_pulses.
+ */
+static int
+event_index(const SmfTrack *track, const SmfEvent *event)
+{
+	int i;
 
-	if (track->number_of_events == 0)
-		track->next_event_number = -1;
+	i = event->event_number - 1;
+	if (i >= 0 && i < track->number_of_events && smf_track_event_at(track, i) == event)
+		return (i);
 
-	/* Renumber the rest of the events, so they are consecutively numbered. */
-	for (i = event->event_number; i <= track->number_of_events; i++) {
-		tmp = smf_track_get_event_by_number(track, i);
-		tmp->event_number = i;
-	}
+	for (i = find_first_event_after_pulses(track, event->time_pulses - 1); i < track->number_of_events; i++) {
+		if (smf_track_event_at(track, i) == event)
+			return (i);
 
-	if (smf_event_is_tempo_change_or_time_signature(event)) {
-		/* XXX: This will cause problems, when there is more than one Tempo Change event at a given time. */
-		if (was_last)
-			remove_last_tempo_with_pulses(event->track->smf, event->time_pulses);
-		else
-			smf_file_create_tempo_map_and_compute_seconds(track->smf);
+		if (event_time_pulses(track, i + 1) > event->time_pulses)
+			break;
 	}
 
-	event->track = NULL;
-	event->event_number = -1;
-	event->delta_time_pulses = -1;
-	event->time_pulses = -1;
-	event->time_seconds = -1.0;
+	return (-1);
 }
 
-void
-smf_event_remove_from_track(smf_event_t *event)
+/*
+ * Updates fields of the event that are derived from its position: ->event_number, ->track_number
+ * and ->delta_time_pulses.  These are not updated when other events or tracks are added or removed;
+ * instead, this is called whenever the event gets accessed.
+ */
+static void
+refresh_event(const SmfTrack *track, SmfEvent *event, int index)
 {
-	assert(event->track != NULL);
-	smf_track_remove_event(event->track, event);
+	event->event_number = index + 1;
+	event->track_number = track->track_number;
+	event->delta_time_pulses = event->time_pulses - (index > 0 ? event_time_pulses(track, index) : 0);
 }
 
-/**
- * smf_event_is_tempo_change_or_time_signature:
- * @event: the event to test
- *
- * Returns: Nonzero if event is Tempo Change or Time Signature metaevent.
+/*
+ * Brings ->event_number, ->track_number and ->delta_time_pulses of the event up to date.
+ */
+static void
+refresh_event_in_track(SmfEvent *event)
+{
+	int index;
+
+	if (event->track == NULL)
+		return;
+
+	index = event_index(event->track, event);
+	assert(index >= 0);
+
+	refresh_event(event->track, event, index);
+}
+
+/**
+ * smf_event_get_event_number:
+ * @event: the event
+ *
+ * Returns: Number of the event in its track, or -1 if it is not in any.  Unlike
+ *   #SmfEvent.event_number, this is right even if events were added or removed since the event
+ *   was obtained.
+ *
+ * Since: 1.4
  */
 int
-smf_event_is_tempo_change_or_time_signature(const SmfEvent *event)
+smf_event_get_event_number(SmfEvent *event)
 {
-	if (!smf_event_is_metadata(event))
-		return (0);
+	refresh_event_in_track(event);
 
-	assert(event->midi_buffer_length >= 2);
+	return (event->event_number);
+}
 
-	if (event->midi_buffer[1] == 0x51 || event->midi_buffer[1] == 0x58)
+/**
+ * smf_event_get_track_number:
+ * @event: the event
+ *
+ * Returns: Number of the track the event is in, or -1 if it is not in any.  Unlike
+ *   #SmfEvent.track_number, this is right even if tracks were removed since the event was obtained.
+ *
+ * Since: 1.4
+ */
+int
+smf_event_get_track_number(SmfEvent *event)
+{
+	refresh_event_in_track(event);
+
+	return (event->track_number);
+}
+
+/**
+ * smf_event_get_delta_time_pulses:
+ * @event: the event
+ *
+ * Returns: Time, in pulses, since the previous event in the track, or -1 if it is not in any.
+ *   Unlike #SmfEvent.delta_time_pulses, this is right even if events were added or removed since
+ *   the event was obtained.
+ *
+ * Since: 1.4
+ */
+int
+smf_event_get_delta_time_pulses(SmfEvent *event)
+{
+	refresh_event_in_track(event);
+
+	return (event->delta_time_pulses);
+}
+
+/*
+ * An assumption here is that if there is an EOT event, it will be at the end of the track.
+ */
+static void
+remove_eot_if_before_pulses(SmfTrack *track, int pulses)
+{
+	SmfEvent *event;
+
+	event = smf_track_get_last_event(track);
+
+	if (event == NULL)
+		return;
+
+	if (!smf_event_is_eot(event))
+		return;
+
+	if (event->time_pulses > pulses)
+		return;
+
+	smf_track_remove_event(track, event);
+}
+
+/**
+ * smf_track_add_event:
+ * @track: The track
+ * @event: event to add to the track
+ *
+ * Adds the event to the track and computes ->delta_pulses.  Position of the event is found
+ * using binary search, after any events that happen at the same time, and the following events
+ * are not renumbered.  Inserting in the middle of the track still moves the pointers to the following
+ * events, unless it happens between smf_file_begin_edit() and smf_file_end_edit(); then events_array
+ * keeps a gap at the place of the last edit, and adding or removing events close to it is cheap.
+ * Usually you want to use smf_track_add_event_seconds or smf_track_add_event_pulses
+ * instead of this one.  Event needs to have ->time_pulses and ->time_seconds already set.
+ * If you try to add event after an EOT, EOT event will be automatically deleted.
+ */
+void
+smf_track_add_event(SmfTrack *track, SmfEvent *event)
+{
+	int index, old_length_pulses;
+
+	assert(track->smf != NULL);
+	assert(event->track == NULL);
+	assert(event->delta_time_pulses == -1);
+	assert(event->time_pulses >= 0);
+	assert(event->time_seconds >= 0.0);
+
+	smf_track_expand(track);
+
+	remove_eot_if_before_pulses(track, event->time_pulses);
+
+	old_length_pulses = smf_track_length_pulses(track);
+
+	track->events_modified = 1;
+	smf_track_events_changed(track);
+
+	event->track = track;
+
+	if (track->number_of_events == 0) {
+		assert(track->next_event_number == -1);
+		track->next_event_number = 1;
+		smf_track_position_changed(track);
+	}
+
+	/* After all the events that happen at the same time, i.e. at the end, when just appending. */
+	index = find_first_event_after_pulses(track, event->time_pulses);
+
+	if (track->smf->edit_depth > 0)
+		insert_into_gap(track, index, event);
+	else if (index == track->number_of_events)
+		g_ptr_array_add(track->events_array, event);
+	else
+		g_ptr_array_insert(track->events_array, index, event);
+
+	track->number_of_events++;
+
+	/* Numbers and ->delta_time_pulses of the following events are derived on access. */
+	refresh_event(track, event, index);
+	assert(event->delta_time_pulses >= 0);
+
+	smf_file_track_length_changed(track->smf, old_length_pulses, smf_track_length_pulses(track));
+
+	/* ->time_seconds was computed using the current tempo map. */
+	event->seconds_generation = track->smf->tempo_generation;
+
+	if (smf_event_is_tempo_change_or_time_signature(event)) {
+		if (smf_event_is_last(event) && !track->smf->tempo_map_dirty)
+			maybe_add_to_tempo_map(event);
+		else
+			smf_file_invalidate_tempo_at(track->smf, event->time_pulses);
+	}
+}
+
+static int
+events_compare_pulses(gconstpointer a, gconstpointer b, G_GNUC_UNUSED gpointer user_data)
+{
+	const SmfEvent *first = *(SmfEvent * const *)a, *second = *(SmfEvent * const *)b;
+
+	if (first->time_pulses < second->time_pulses)
+		return (-1);
+
+	if (first->time_pulses > second->time_pulses)
 		return (1);
 
 	return (0);
 }
 
+/*
+ * Internal:
+ *
+ * Adds "number_of_events" events, with ->time_pulses already set, to the track.  The result is
+ * the same as adding them one by one, in order of ->time_pulses, using smf_track_add_event(), but
+ * the events are sorted once, merged into events_array in a single pass and the tempo map gets
+ * rebuilt at most once.  If "compute_seconds" is zero, ->time_seconds needs to be set too.
+ */
+void
+smf_track_add_events(SmfTrack *track, SmfEvent **events, int number_of_events, int compute_seconds)
+{
+	SmfEvent **sorted;
+	int i, j, k, first_index, old_number_of_events, old_length_pulses, tempo_number = 0;
+	int has_tempo = 0, appending, is_sorted = 1;
+
+	assert(track->smf != NULL);
+	assert(number_of_events >= 0);
+
+	if (number_of_events == 0)
+		return;
+
+	sorted = g_new(SmfEvent *, number_of_events);
+	memcpy(sorted, events, number_of_events * sizeof(*sorted));
+
+	for (i = 0; i < number_of_events; i++) {
+		assert(sorted[i]->track == NULL);
+		assert(sorted[i]->delta_time_pulses == -1);
+		assert(sorted[i]->time_pulses >= 0);
+		assert(compute_seconds || sorted[i]->time_seconds >= 0.0);
+
+		if (i > 0 && sorted[i]->time_pulses < sorted[i - 1]->time_pulses)
+			is_sorted = 0;
+	}
+
+	/* Generators usually produce sorted events already.  Both sorts are stable. */
+	if (!is_sorted) {
+#if GLIB_CHECK_VERSION(2, 82, 0)
+		g_sort_array(sorted, number_of_events, sizeof(*sorted), events_compare_pulses, NULL);
+#else
+		g_qsort_with_data(sorted, number_of_events, sizeof(*sorted), events_compare_pulses, NULL);
+#endif
+	}
+
+	/* If all the new events come after the end of the song, tempo changes among them can just be appended. */
+	appending = (sorted[0]->time_pulses >= smf_file_get_length_pulses(track->smf));
+
+	smf_track_expand(track);
+	close_gap(track);
+
+	remove_eot_if_before_pulses(track, sorted[number_of_events - 1]->time_pulses);
+
+	old_length_pulses = smf_track_length_pulses(track);
+
+	track->events_modified = 1;
+	smf_track_events_changed(track);
+
+	if (track->number_of_events == 0) {
+		assert(track->next_event_number == -1);
+		track->next_event_number = 1;
+		smf_track_position_changed(track);
+	}
+
+	/* Merge from the end, so that every event is moved at most once. */
+	old_number_of_events = track->number_of_events;
+	g_ptr_array_set_size(track->events_array, old_number_of_events + number_of_events);
+
+	i = old_number_of_events - 1;
+	j = number_of_events - 1;
+	k = old_number_of_events + number_of_events - 1;
+
+	while (j >= 0) {
+		/* New events go after existing ones that happen at the same time. */
+		if (i >= 0 && event_time_pulses(track, i + 1) > sorted[j]->time_pulses) {
+			track->events_array->pdata[k--] = track->events_array->pdata[i--];
+		} else {
+			sorted[j]->track = track;
+			track->events_array->pdata[k--] = sorted[j--];
+		}
+	}
+
+	first_index = i + 1;
+	track->number_of_events += number_of_events;
+
+	smf_file_track_length_changed(track->smf, old_length_pulses, smf_track_length_pulses(track));
+
+	for (k = first_index; k < track->number_of_events; k++)
+		refresh_event(track, g_ptr_array_index(track->events_array, k), k);
+
+	for (j = 0; j < number_of_events; j++) {
+		if (smf_event_is_tempo_change_or_time_signature(sorted[j]))
+			has_tempo = 1;
+	}
+
+	if (has_tempo && (!appending || track->smf->tempo_map_dirty)) {
+		smf_file_invalidate_tempo_map(track->smf, sorted[0]->time_pulses);
+	} else {
+		for (j = 0; j < number_of_events; j++) {
+			if (compute_seconds)
+				sorted[j]->time_seconds = seconds_from_pulses_walking(track->smf, sorted[j]->time_pulses, &tempo_number);
+
+			if (smf_event_is_tempo_change_or_time_signature(sorted[j]))
+				maybe_add_to_tempo_map(sorted[j]);
+		}
+	}
+
+	g_free(sorted);
+}
+
+/*
+ * Internal:
+ *
+ * Appends event, freshly parsed from the file, at the end of the track, "delta" pulses after
+ * the previous one.  Unlike smf_track_add_event_delta_pulses(), it doesn't care about EOT, tempo map,
+ * ->time_seconds or the cached length of the song; caller is supposed to take care of that once all
+ * the events are in place.  Tracks of the same song may get parsed in parallel, so this must not
+ * touch anything but the track.
+ */
+void
+smf_track_append_parsed_event(SmfTrack *track, SmfEvent *event, int delta)
+{
+	assert(track->smf != NULL);
+	assert(event->track == NULL);
+	assert(delta >= 0);
+	assert(track->columns == NULL);
+
+	event->track = track;
+	event->track_number = track->track_number;
+	event->delta_time_pulses = delta;
+	event->time_pulses = delta;
+
+	if (track->number_of_events == 0) {
+		assert(track->next_event_number == -1);
+		track->next_event_number = 1;
+	} else {
+		SmfEvent *last_event = g_ptr_array_index(track->events_array, track->number_of_events - 1);
+		event->time_pulses += last_event->time_pulses;
+	}
+
+	g_ptr_array_add(track->events_array, event);
+	track->number_of_events++;
+	event->event_number = track->number_of_events;
+}
+
 /**
- * smf_file_set_format:
- * @smf: the SMF
- * @format: Use 0 for one track per file, 1 for several tracks per file.
+ * smf_track_add_eot_delta_pulses:
+ * @track: the track
+ * @delta: delta
  *
- * Sets "Format" field of MThd header to the specified value.  Note that you
- * don't really need to use this, as libsmf will automatically change format
- * from 0 to 1 when you add the second track.
+ * Add End Of Track metaevent.  Using it is optional, libsmf will automatically
+ * add EOT to the tracks during smf_file_save(), with delta_pulses 0.  If you try to add EOT
+ * in the middle of the track, it will fail and nonzero value will be returned.
+ * If you try to add EOT after another EOT event, it will be added, but the existing
+ * EOT event will be removed.
  *
  * Returns: 0 if everything went ok, nonzero otherwise.
  */
 int
-smf_file_set_format(SmfFile *smf, int format)
+smf_track_add_eot_delta_pulses(SmfTrack *track, int delta)
 {
-	assert(format == 0 || format == 1);
+	SmfEvent *event;
 
-	if (smf->number_of_tracks > 1 && format == 0) {
-		g_critical("There is more than one track, cannot set format to 0.");
+	event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
+	if (event == NULL)
 		return (-1);
+
+	smf_track_add_event_delta_pulses(track, event, delta);
+
+	return (0);
+}
+
+/**
+ * smf_track_add_eot_pulses:
+ * @track: the track
+ * @pulses: pulses
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_track_add_eot_pulses(SmfTrack *track, int pulses)
+{
+	SmfEvent *event, *last_event;
+
+	last_event = smf_track_get_last_event(track);
+	if (last_event != NULL) {
+		if (last_event->time_pulses > pulses)
+			return (-2);
 	}
 
-	smf->format = format;
+	event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
+	if (event == NULL)
+		return (-3);
+
+	smf_track_add_event_pulses(track, event, pulses);
+
+	return (0);
+}
+
+/**
+ * smf_track_add_eot_seconds:
+ * @track: the track
+ * @seconds: seconds
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_track_add_eot_seconds(SmfTrack *track, double seconds)
+{
+	SmfEvent *event, *last_event;
+
+	last_event = smf_track_get_last_event(track);
+	if (last_event != NULL) {
+		if (smf_event_get_time_seconds(last_event) > seconds)
+			return (-2);
+	}
+
+	event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
+	if (event == NULL)
+		return (-1);
+
+	smf_track_add_event_seconds(track, event, seconds);
+
+	return (0);
+}
+
+/**
+ * smf_track_remove_event:
+ * @track: track to remove @event from
+ * @event: the event to remove
+ *
+ * Detaches @event from @track
+ *
+ * Since: 1.4
+ */
+void
+smf_track_remove_event(smf_track_t *track, smf_event_t *event)
+{
+	int index, was_last, old_length_pulses;
+
+	assert(track != NULL);
+	assert(track->smf != NULL);
+
+	smf_track_expand(track);
+
+	index = event_index(track, event);
+	assert(index >= 0);
+
+	was_last = smf_event_is_last(event);
+	old_length_pulses = smf_track_length_pulses(track);
+
+	track->events_modified = 1;
+	smf_track_events_changed(track);
+
+	/* events_array holds a reference; keep the event alive until we are done with it. */
+	event = smf_event_ref(event);
+
+	/* Numbers and ->delta_time_pulses of the following events are derived on access. */
+	track->number_of_events--;
+
+	if (track->smf->edit_depth > 0) {
+		remove_into_gap(track, index);
+		smf_event_unref(event);
+	} else {
+		g_ptr_array_remove_index(track->events_array, index);
+	}
+
+	if (track->number_of_events == 0) {
+		track->next_event_number = -1;
+		smf_track_position_changed(track);
+	}
+
+	smf_file_track_length_changed(track->smf, old_length_pulses, smf_track_length_pulses(track));
+
+	if (smf_event_is_tempo_change_or_time_signature(event)) {
+		/* XXX: This will cause problems, when there is more than one Tempo Change event at a given time. */
+		if (was_last && !track->smf->tempo_map_dirty && !track->smf->lazy_seconds)
+			remove_last_tempo_with_pulses(event->track->smf, event->time_pulses);
+		else
+			smf_file_invalidate_tempo_at(track->smf, event->time_pulses);
+	}
+
+	event->track = NULL;
+	event->track_number = -1;
+	event->event_number = -1;
+	event->delta_time_pulses = -1;
+	event->time_pulses = -1;
+	event->time_seconds = -1.0;
+
+	smf_event_unref(event);
+}
+
+void
+smf_event_remove_from_track(smf_event_t *event)
+{
+	assert(event->track != NULL);
+	smf_track_remove_event(event->track, event);
+}
+
+/*
+ * Removes events of the track for which "func" returns TRUE, without touching the tempo map.
+ * Returns number of removed events.  If any of them was a tempo change or time signature,
+ * *first_tempo_pulses is lowered to its time, unless it is lower already, or -1.
+ */
+static int
+remove_events_if(SmfTrack *track, SmfEventFilterFunc func, gpointer user_data, int *first_tempo_pulses)
+{
+	int i, kept = 0, removed = 0, old_length_pulses;
+	char *remove;
+	SmfEvent *event;
+
+	assert(track->smf != NULL);
+
+	smf_track_expand(track);
+	close_gap(track);
+
+	if (track->number_of_events == 0)
+		return (0);
+
+	/*
+	 * Ask about all the events before removing any, so that "func" sees the track intact, e.g. when
+	 * it calls smf_event_get_event_number(), which might need to look at the other events.
+	 */
+	remove = g_new(char, track->number_of_events);
+
+	for (i = 0; i < track->number_of_events; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+
+		/* Like any other event libsmf hands out, it has to have its numbers up to date. */
+		refresh_event(track, event, i);
+
+		remove[i] = !!func(event, user_data);
+		removed += remove[i];
+	}
+
+	if (removed == 0) {
+		g_free(remove);
+		return (0);
+	}
+
+	old_length_pulses = smf_track_length_pulses(track);
+
+	for (i = 0; i < track->number_of_events; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+
+		if (!remove[i]) {
+			track->events_array->pdata[kept++] = event;
+			continue;
+		}
+
+		if (smf_event_is_tempo_change_or_time_signature(event) &&
+		    (*first_tempo_pulses == -1 || event->time_pulses < *first_tempo_pulses))
+			*first_tempo_pulses = event->time_pulses;
+
+		event->track = NULL;
+		event->track_number = -1;
+		event->event_number = -1;
+		event->delta_time_pulses = -1;
+		event->time_pulses = -1;
+		event->time_seconds = -1.0;
+
+		/* Drops the reference held by events_array. */
+		smf_event_unref(event);
+	}
+
+	g_free(remove);
+
+	/* Slots past the end hold stale pointers; clear them, so that shrinking does not unref anything. */
+	for (i = kept; i < track->number_of_events; i++)
+		track->events_array->pdata[i] = NULL;
+
+	g_ptr_array_set_size(track->events_array, kept);
+
+	/* Numbers and ->delta_time_pulses of the remaining events are derived on access. */
+	track->number_of_events = kept;
+	track->events_modified = 1;
+	smf_track_events_changed(track);
+
+	if (track->number_of_events == 0) {
+		track->next_event_number = -1;
+		smf_track_position_changed(track);
+	}
+
+	smf_file_track_length_changed(track->smf, old_length_pulses, smf_track_length_pulses(track));
+
+	return (removed);
+}
+
+/**
+ * smf_track_remove_events_if:
+ * @track: the track
+ * @func: (scope call): function deciding which events to remove
+ * @user_data: data passed to @func
+ *
+ * Removes all the events of @track for which @func returns %TRUE.  This is much faster than
+ * calling smf_track_remove_event() for each of them: events are removed in a single pass and
+ * the tempo map is rebuilt at most once, only if a tempo change or time signature was removed.
+ * @func is called for every event before any of them is removed, so it may use accessors such as
+ * smf_event_get_event_number(); it must not modify the track.
+ *
+ * Returns: Number of removed events.
+ *
+ * Since: 1.4
+ */
+int
+smf_track_remove_events_if(SmfTrack *track, SmfEventFilterFunc func, gpointer user_data)
+{
+	int removed, first_tempo_pulses = -1;
+
+	assert(track != NULL);
+
+	removed = remove_events_if(track, func, user_data, &first_tempo_pulses);
+
+	if (first_tempo_pulses != -1)
+		smf_file_invalidate_tempo_map(track->smf, first_tempo_pulses);
+
+	return (removed);
+}
+
+/**
+ * smf_file_remove_events_if:
+ * @smf: the SMF
+ * @func: (scope call): function deciding which events to remove
+ * @user_data: data passed to @func
+ *
+ * Like smf_track_remove_events_if(), but for all the tracks in @smf.  The tempo map is
+ * rebuilt at most once for the whole file.
+ *
+ * Returns: Number of removed events.
+ *
+ * Since: 1.4
+ */
+int
+smf_file_remove_events_if(SmfFile *smf, SmfEventFilterFunc func, gpointer user_data)
+{
+	int i, removed = 0, first_tempo_pulses = -1;
+
+	assert(smf != NULL);
+
+	for (i = 1; i <= smf->number_of_tracks; i++)
+		removed += remove_events_if(smf_file_get_track_by_number(smf, i), func, user_data, &first_tempo_pulses);
+
+	if (first_tempo_pulses != -1)
+		smf_file_invalidate_tempo_map(smf, first_tempo_pulses);
+
+	return (removed);
+}
+
+/**
+ * smf_file_begin_edit:
+ * @smf: the SMF
+ *
+ * Starts a batch of edits.  Normally, adding or removing a tempo change or time signature
+ * anywhere but at the end of the song updates the tempo map and recomputes ->time_seconds
+ * of all the events after it right away.  Between smf_file_begin_edit() and the matching
+ * smf_file_end_edit(), this is done only once, at the end.  Until then, the tempo map
+ * and ->time_seconds, including these of the added events, may be out of date, and so
+ * may be conversions between pulses and seconds.  #SmfTrack.events_array may contain %NULL
+ * entries, see smf_track_add_event(), so use smf_track_get_event_by_number() instead.
+ * Calls can be nested.
+ *
+ * Since: 1.4
+ */
+void
+smf_file_begin_edit(SmfFile *smf)
+{
+	assert(smf != NULL);
+	assert(smf->edit_depth >= 0);
+
+	smf->edit_depth++;
+}
+
+/**
+ * smf_file_end_edit:
+ * @smf: the SMF
+ *
+ * Ends a batch of edits started with smf_file_begin_edit().  When the outermost batch ends,
+ * tempo map and ->time_seconds of all the events are brought up to date, if needed.
+ *
+ * Since: 1.4
+ */
+void
+smf_file_end_edit(SmfFile *smf)
+{
+	int i;
+
+	assert(smf != NULL);
+
+	if (smf->edit_depth <= 0) {
+		g_critical("smf_file_end_edit() called without smf_file_begin_edit().");
+		return;
+	}
+
+	smf->edit_depth--;
+
+	if (smf->edit_depth == 0) {
+		for (i = 0; i < smf->tracks_array->len; i++)
+			close_gap(g_ptr_array_index(smf->tracks_array, i));
+	}
+
+	if (smf->edit_depth == 0 && smf->tempo_map_dirty)
+		smf_file_invalidate_tempo_map(smf, smf->tempo_map_dirty_pulses);
+}
+
+/**
+ * smf_event_is_tempo_change_or_time_signature:
+ * @event: the event to test
+ *
+ * Returns: Nonzero if event is Tempo Change or Time Signature metaevent.
+ */
+int
+smf_event_is_tempo_change_or_time_signature(const SmfEvent *event)
+{
+	if (!smf_event_is_metadata(event))
+		return (0);
+
+	assert(event->midi_buffer_length >= 2);
+
+	if (event->midi_buffer[1] == 0x51 || event->midi_buffer[1] == 0x58)
+		return (1);
+
+	return (0);
+}
+
+/**
+ * smf_file_set_format:
+ * @smf: the SMF
+ * @format: Use 0 for one track per file, 1 for several tracks per file.
+ *
+ * Sets "Format" field of MThd header to the specified value.  Note that you
+ * don't really need to use this, as libsmf will automatically change format
+ * from 0 to 1 when you add the second track.
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_file_set_format(SmfFile *smf, int format)
+{
+	assert(format == 0 || format == 1);
+
+	if (smf->number_of_tracks > 1 && format == 0) {
+		g_critical("There is more than one track, cannot set format to 0.");
+		return (-1);
+	}
+
+	smf->format = format;
+
+	return (0);
+}
+
+/**
+ * smf_file_set_ppqn:
+ * @smf: the SMF
+ * @ppqn: New PPQN
+ *
+ * Sets the PPQN ("Division") field of MThd header.  This is mandatory, you
+ * should call it right after smf_new.  Note that changing PPQN will change time_seconds
+ * of all the events.
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_file_set_ppqn(SmfFile *smf, int ppqn)
+{
+	assert(ppqn > 0);
+
+	smf->ppqn = ppqn;
+	smf->tempo_generation++;
+
+	return (0);
+}
+
+/*
+ * Creates the event from columns of the compacted track and puts it into events_array,
+ * where it stays until the next smf_track_compact().
+ */
+static SmfEvent *
+materialize_event(SmfTrack *track, int event_number)
+{
+	int i = event_number - 1;
+	SmfEvent *event;
+	struct smf_event_columns *columns = track->columns;
+
+	assert(columns != NULL);
+	assert(g_ptr_array_index(track->events_array, i) == NULL);
+
+	event = smf_event_new();
+	if (event == NULL)
+		return (NULL);
+
+	if (columns->length[i] > 0) {
+		if (smf_event_allocate_buffer(event, columns->length[i])) {
+			smf_event_unref(event);
+			return (NULL);
+		}
+
+		if (columns->payload_offset[i] >= 0) {
+			memcpy(event->midi_buffer, columns->payload + columns->payload_offset[i], columns->length[i]);
+		} else {
+			event->midi_buffer[0] = columns->status[i];
+			memcpy(event->midi_buffer + 1, columns->data[i], columns->length[i] - 1);
+		}
+	}
+
+	event->track = track;
+	event->track_number = track->track_number;
+	event->event_number = event_number;
+	event->time_pulses = columns->time_pulses[i];
+	event->time_seconds = event_time_seconds(track, event_number);
+	event->delta_time_pulses = columns->time_pulses[i] - (i > 0 ? columns->time_pulses[i - 1] : 0);
+
+	g_ptr_array_index(track->events_array, i) = event;
+
+	return (event);
+}
+
+/*
+ * Internal:
+ *
+ * Returns the event with the given number, if it exists as #SmfEvent already.  Otherwise, fills
+ * "view" so that it looks like the event would, without allocating anything, and returns it.
+ * The view is valid until the track is modified or compacted again.
+ */
+const SmfEvent *
+smf_track_get_event_view(const SmfTrack *track, int event_number, SmfEvent *view)
+{
+	int i = event_number - 1;
+	SmfEvent *event;
+	struct smf_event_columns *columns = track->columns;
+
+	touch_track(track);
+
+	event = smf_track_event_at(track, i);
+	if (event != NULL) {
+		maybe_update_time_seconds(event);
+		return (event);
+	}
+
+	assert(columns != NULL);
+
+	memset(view, 0, sizeof(SmfEvent));
+
+	view->track = (SmfTrack *)track;
+	view->track_number = track->track_number;
+	view->event_number = event_number;
+	view->time_pulses = columns->time_pulses[i];
+	view->time_seconds = event_time_seconds(track, event_number);
+	view->delta_time_pulses = columns->time_pulses[i] - (i > 0 ? columns->time_pulses[i - 1] : 0);
+	view->midi_buffer_length = columns->length[i];
+
+	if (columns->payload_offset[i] >= 0) {
+		view->midi_buffer = columns->payload + columns->payload_offset[i];
+	} else {
+		view->midi_buffer = view->inline_buffer;
+		view->inline_buffer[0] = columns->status[i];
+		memcpy(view->inline_buffer + 1, columns->data[i], 2);
+	}
+
+	return (view);
+}
+
+/*
+ * Internal:
+ *
+ * Converts compacted track back into the usual representation, where every event is an #SmfEvent
+ * in events_array.  Called before modifying the track.
+ */
+void
+smf_track_expand(SmfTrack *track)
+{
+	int i;
+
+	if (track->columns == NULL)
+		return;
+
+	for (i = 1; i <= track->number_of_events; i++) {
+		if (g_ptr_array_index(track->events_array, i - 1) == NULL && materialize_event(track, i) == NULL)
+			g_error("Cannot allocate events when expanding compacted track.");
+	}
+
+	free_event_columns(track->columns);
+	track->columns = NULL;
+}
+
+/*
+ * Allocates columns for "number_of_events" events with "payload_length" bytes of longer messages.
+ */
+static struct smf_event_columns *
+new_event_columns(int number_of_events, int payload_length, int lazy_seconds)
+{
+	struct smf_event_columns *columns;
+
+	columns = calloc(1, sizeof(struct smf_event_columns));
+	if (columns == NULL)
+		return (NULL);
+
+	columns->time_pulses = malloc(number_of_events * sizeof(*columns->time_pulses));
+	/* With lazy seconds, ->time_seconds gets computed when needed, so there's no point in storing it. */
+	if (!lazy_seconds)
+		columns->time_seconds = malloc(number_of_events * sizeof(*columns->time_seconds));
+	columns->length = malloc(number_of_events * sizeof(*columns->length));
+	columns->status = malloc(number_of_events * sizeof(*columns->status));
+	columns->data = calloc(number_of_events, sizeof(*columns->data));
+	columns->payload_offset = malloc(number_of_events * sizeof(*columns->payload_offset));
+	columns->payload = malloc(payload_length > 0 ? payload_length : 1);
+
+	if (columns->time_pulses == NULL || (columns->time_seconds == NULL && !lazy_seconds) || columns->length == NULL ||
+	    columns->status == NULL || columns->data == NULL || columns->payload_offset == NULL ||
+	    columns->payload == NULL) {
+		free_event_columns(columns);
+		return (NULL);
+	}
+
+	return (columns);
+}
+
+/**
+ * smf_track_compact:
+ * @track: the track
+ *
+ * Converts the track into compact representation: instead of a separately allocated #SmfEvent
+ * for every event, times and MIDI data of the events get stored in a few contiguous arrays.
+ * This takes several times less memory, and iterating or seeking through the track does not
+ * need to chase pointers anymore.  #SmfEvent structures are created when asked for, e.g. by
+ * smf_track_get_next_event(), and stay around until the track is compacted again.
+ *
+ * Events referenced from elsewhere, or with user_pointer set, are kept.  Pointers to other events
+ * of the track become invalid.  Adding or removing events converts the track back into
+ * the usual representation.
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ *
+ * Since: 1.4
+ */
+int
+smf_track_compact(SmfTrack *track)
+{
+	int i, payload_length = 0;
+	SmfEvent *event;
+	struct smf_event_columns *columns;
+
+	touch_track(track);
+
+	if (track->number_of_events == 0)
+		return (0);
+
+	/* Columns are indexed the same as events_array. */
+	close_gap(track);
+
+	if (track->columns == NULL) {
+		for (i = 0; i < track->number_of_events; i++) {
+			event = g_ptr_array_index(track->events_array, i);
+
+			if (event->midi_buffer_length > 3)
+				payload_length += event->midi_buffer_length;
+		}
+
+		columns = new_event_columns(track->number_of_events, payload_length, track->smf != NULL && track->smf->lazy_seconds);
+		if (columns == NULL) {
+			g_critical("Cannot allocate memory in smf_track_compact(): %s", strerror(errno));
+			return (-1);
+		}
+
+		payload_length = 0;
+
+		for (i = 0; i < track->number_of_events; i++) {
+			event = g_ptr_array_index(track->events_array, i);
+
+			columns->time_pulses[i] = event->time_pulses;
+			if (columns->time_seconds != NULL)
+				columns->time_seconds[i] = event->time_seconds;
+			columns->length[i] = event->midi_buffer_length;
+			columns->status[i] = event->midi_buffer_length > 0 ? event->midi_buffer[0] : 0;
+			columns->payload_offset[i] = -1;
+
+			if (event->midi_buffer_length > 3) {
+				memcpy(columns->payload + payload_length, event->midi_buffer, event->midi_buffer_length);
+				columns->payload_offset[i] = payload_length;
+				payload_length += event->midi_buffer_length;
+			} else if (event->midi_buffer_length > 1) {
+				memcpy(columns->data[i], event->midi_buffer + 1, event->midi_buffer_length - 1);
+			}
+		}
+
+		track->columns = columns;
+	}
+
+	/* Drop events that nobody else uses; they will be recreated from the columns when needed. */
+	for (i = 0; i < track->number_of_events; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+
+		if (event == NULL || event->user_pointer != NULL || g_atomic_int_get(&event->ref_count) > 1)
+			continue;
+
+		g_ptr_array_index(track->events_array, i) = NULL;
+		smf_event_unref(event);
+	}
+
+	return (0);
+}
+
+/**
+ * smf_file_compact:
+ * @smf: the SMF
+ *
+ * Calls smf_track_compact() for all the tracks.
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ *
+ * Since: 1.4
+ */
+int
+smf_file_compact(SmfFile *smf)
+{
+	int i;
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		if (smf_track_compact(smf_file_get_track_by_number(smf, i)))
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Returns copy of the columns of the compacted track.  There is no ->time_seconds column if "lazy_seconds"
+ * is nonzero.
+ */
+static struct smf_event_columns *
+copy_event_columns(const SmfTrack *source, int lazy_seconds)
+{
+	int i, number_of_events = source->number_of_events, payload_length = 0;
+	struct smf_event_columns *columns, *source_columns = source->columns;
+
+	for (i = 0; i < number_of_events; i++) {
+		if (source_columns->payload_offset[i] >= 0)
+			payload_length = MAX(payload_length, source_columns->payload_offset[i] + source_columns->length[i]);
+	}
+
+	columns = new_event_columns(number_of_events, payload_length, lazy_seconds);
+	if (columns == NULL)
+		return (NULL);
+
+	memcpy(columns->time_pulses, source_columns->time_pulses, number_of_events * sizeof(*columns->time_pulses));
+	memcpy(columns->length, source_columns->length, number_of_events * sizeof(*columns->length));
+	memcpy(columns->status, source_columns->status, number_of_events * sizeof(*columns->status));
+	memcpy(columns->data, source_columns->data, number_of_events * sizeof(*columns->data));
+	memcpy(columns->payload_offset, source_columns->payload_offset, number_of_events * sizeof(*columns->payload_offset));
+	memcpy(columns->payload, source_columns->payload, payload_length);
+
+	if (columns->time_seconds != NULL) {
+		if (source_columns->time_seconds != NULL && (source->smf == NULL || !source->smf->lazy_seconds)) {
+			memcpy(columns->time_seconds, source_columns->time_seconds, number_of_events * sizeof(*columns->time_seconds));
+		} else {
+			for (i = 0; i < number_of_events; i++)
+				columns->time_seconds[i] = event_time_seconds(source, i + 1);
+		}
+	}
+
+	return (columns);
+}
+
+/*
+ * Fills the empty track with copies of the events of "source", which must not be lazily loaded.
+ * Compacted tracks get copied column by column.  Otherwise, all the events are allocated from
+ * a single arena, sized to fit them exactly.  Returns 0 if everything went ok.
+ */
+static int
+copy_events(SmfTrack *track, SmfTrack *source)
+{
+	int i, lazy_seconds, trailing_length;
+	size_t arena_size = 0;
+	smf_arena_t *arena;
+	SmfEvent *event, *source_event;
+
+	assert(track->number_of_events == 0);
+	assert(!source->events_pending);
+
+	lazy_seconds = (track->smf != NULL && track->smf->lazy_seconds);
+
+	if (source->number_of_events == 0)
+		return (0);
+
+	if (source->columns != NULL) {
+		track->columns = copy_event_columns(source, lazy_seconds);
+		if (track->columns == NULL) {
+			g_critical("Cannot allocate memory for a copy of the track: %s", strerror(errno));
+			return (-1);
+		}
+
+		/* Events get created when asked for, just like in the original track. */
+		g_ptr_array_set_size(track->events_array, source->number_of_events);
+		track->number_of_events = source->number_of_events;
+
+		return (0);
+	}
+
+	for (i = 0; i < source->number_of_events; i++) {
+		source_event = smf_track_event_at(source, i);
+		trailing_length = source_event->midi_buffer_length > SMF_EVENT_INLINE_BUFFER_SIZE ? source_event->midi_buffer_length : 0;
+		arena_size += ARENA_ROUND(sizeof(SmfEvent) + trailing_length);
+	}
+
+	arena = smf_arena_new(arena_size);
+	if (arena == NULL)
+		return (-1);
+
+	smf_track_reserve_events(track, source->number_of_events);
+
+	for (i = 0; i < source->number_of_events; i++) {
+		source_event = smf_track_event_at(source, i);
+
+		event = smf_event_new_from_arena(arena, source_event->midi_buffer_length);
+		if (event == NULL) {
+			smf_arena_unref(arena);
+			return (-1);
+		}
+
+		if (source_event->midi_buffer_length > 0)
+			memcpy(event->midi_buffer, source_event->midi_buffer, source_event->midi_buffer_length);
+
+		event->track = track;
+		event->track_number = track->track_number;
+		event->event_number = i + 1;
+		event->time_pulses = source_event->time_pulses;
+		event->delta_time_pulses = event->time_pulses - (i > 0 ? event_time_pulses(track, i) : 0);
+		event->time_seconds = smf_event_get_time_seconds(source_event);
+		event->user_pointer = source_event->user_pointer;
+
+		if (track->smf != NULL)
+			event->seconds_generation = track->smf->tempo_generation;
+
+		g_ptr_array_add(track->events_array, event);
+		track->number_of_events++;
+	}
+
+	/* Events hold their own references. */
+	smf_arena_unref(arena);
+
+	return (0);
+}
+
+/*
+ * Copies position of the next event, user_pointer and whatever was left by the loader.
+ */
+static void
+copy_track_state(SmfTrack *track, const SmfTrack *source)
+{
+	track->last_status = source->last_status;
+	track->next_event_offset = source->next_event_offset;
+	track->next_event_number = source->next_event_number;
+	track->time_of_next_event = source->time_of_next_event;
+	track->user_pointer = source->user_pointer;
+
+	smf_track_position_changed(track);
+}
+
+/*
+ * Makes "track", empty and just added to its smf, a copy of "source".
+ */
+static int
+copy_track(SmfTrack *track, SmfTrack *source)
+{
+	assert(track->smf != NULL);
+
+	/* Parsing events of lazily loaded tracks can wait, as long as the file mapping is shared. */
+	if (source->events_pending && track->smf->mapped_file != NULL) {
+		track->number_of_events = source->number_of_events;
+		track->events_pending = 1;
+	} else {
+		touch_track(source);
+
+		if (copy_events(track, source))
+			return (-1);
+	}
+
+	if (track->smf->mapped_file != NULL) {
+		track->chunk_offset = source->chunk_offset;
+		track->chunk_length = source->chunk_length;
+		track->chunk_length_pulses = source->chunk_length_pulses;
+		track->events_modified = source->events_modified;
+	}
+
+	copy_track_state(track, source);
+
+	return (0);
+}
+
+/**
+ * smf_track_clone:
+ * @track: the track
+ *
+ * Creates a copy of @track, with copies of all its events, user_pointer included.  Times of the events
+ * are copied instead of being recomputed, and the events are allocated all at once; this is much faster
+ * than adding them one by one.  The copy does not belong to any song; add it using smf_file_add_track().
+ *
+ * Returns: (transfer full): The copy, or %NULL on error.
+ *
+ * Since: 1.4
+ */
+SmfTrack *
+smf_track_clone(SmfTrack *track)
+{
+	SmfTrack *clone;
+
+	clone = smf_track_new();
+	if (clone == NULL)
+		return (NULL);
+
+	touch_track(track);
+
+	if (copy_events(clone, track)) {
+		smf_track_unref(clone);
+		return (NULL);
+	}
+
+	copy_track_state(clone, track);
+
+	return (clone);
+}
+
+/**
+ * smf_file_clone:
+ * @smf: the SMF
+ *
+ * Creates a copy of @smf, with copies of all its tracks, their events and the tempo map; see
+ * smf_track_clone().  Nothing gets recomputed, except for the tempo map, if it is out of date because
+ * of smf_file_begin_edit().  Compacted tracks stay compacted, and tracks loaded by smf_file_load_lazy()
+ * whose events were not parsed yet stay that way.  Current position, e.g. set by smf_file_seek_to_pulses(),
+ * is copied as well.
+ *
+ * Returns: (transfer full): The copy, or %NULL on error.
+ *
+ * Since: 1.4
+ */
+SmfFile *
+smf_file_clone(SmfFile *smf)
+{
+	int i;
+	SmfFile *clone;
+	SmfTrack *track;
+
+	clone = smf_file_new();
+	if (clone == NULL)
+		return (NULL);
+
+	clone->ppqn = smf->ppqn;
+	clone->frames_per_second = smf->frames_per_second;
+	clone->resolution = smf->resolution;
+	clone->lazy_seconds = smf->lazy_seconds;
+
+	if (smf->mapped_file != NULL)
+		clone->mapped_file = g_mapped_file_ref(smf->mapped_file);
+
+	if (smf_file_copy_tempo_map(clone, smf))
+		goto error;
+
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			goto error;
+
+		smf_file_add_track(clone, track);
+
+		if (copy_track(track, g_ptr_array_index(smf->tracks_array, i)))
+			goto error;
+	}
+
+	clone->format = smf->format;
+	clone->expected_number_of_tracks = smf->expected_number_of_tracks;
+	clone->last_seek_position = smf->last_seek_position;
+	clone->use_timeline_index = smf->use_timeline_index;
+
+	/* Timeline of the clone, once built, has events in the same order. */
+	clone->timeline_position = smf->timeline_position;
+
+	if (smf->tempo_map_dirty)
+		smf_file_invalidate_tempo_map(clone, smf->tempo_map_dirty_pulses);
+
+	return (clone);
+
+error:
+	g_critical("Cannot clone the SMF.");
+	smf_file_unref(clone);
+
+	return (NULL);
+}
+
+/**
+ * smf_track_get_event_by_number:
+ * @track: the track
+ * @event_number: event number to retrieve
+ *
+ * Returns: Event with a given number or NULL, if there is no such event.
+ *   Events are numbered consecutively starting from one.
+ */
+SmfEvent *
+smf_track_get_event_by_number(const SmfTrack *track, int event_number)
+{
+	SmfEvent *event;
+
+	assert(event_number >= 1);
+
+	if (event_number > track->number_of_events)
+		return (NULL);
+
+	touch_track(track);
+
+	event = smf_track_event_at(track, event_number - 1);
+
+	if (event == NULL)
+		event = materialize_event((SmfTrack *)track, event_number);
+
+	assert(event);
+
+	refresh_event(track, event, event_number - 1);
+	maybe_update_time_seconds(event);
+
+	return (event);
+}
+
+/**
+ * smf_track_get_last_event:
+ * @track: the track
+ *
+ * Returns: Last event on the track or NULL, if track is empty.
+ */
+SmfEvent *
+smf_track_get_last_event(const SmfTrack *track)
+{
+	SmfEvent *event;
+
+	if (track->number_of_events == 0)
+		return (NULL);
+       
+	event = smf_track_get_event_by_number(track, track->number_of_events);
+
+	return (event);
+}
+
+/*
+ * Internal:
+ *
+ * Must be called after changing ->next_event_number or ->time_of_next_event of the track
+ * other than through smf_file_get_next_event(), so that the order of tracks gets rebuilt.
+ */
+void
+smf_track_position_changed(SmfTrack *track)
+{
+	if (track->smf == NULL)
+		return;
+
+	track->smf->next_event_heap_valid = 0;
+	track->smf->timeline_position = -1;
+}
+
+/*
+ * Internal:
+ *
+ * Must be called after adding or removing events of the track, so that the timeline,
+ * if any, gets rebuilt.
+ */
+void
+smf_track_events_changed(SmfTrack *track)
+{
+	if (track->smf == NULL)
+		return;
+
+	track->smf->timeline_valid = 0;
+	track->smf->timeline_position = -1;
+}
+
+/*
+ * Returns 1 iff next event of track "a" should be played before the one of track "b".
+ * Ties go to the lower numbered track.
+ */
+static int
+track_plays_before(const SmfTrack *a, const SmfTrack *b)
+{
+	if (a->time_of_next_event != b->time_of_next_event)
+		return (a->time_of_next_event < b->time_of_next_event);
+
+	return (a->track_number < b->track_number);
+}
+
+/*
+ * Moves the track at "index" down smf->next_event_heap, until it no longer plays after its children.
+ */
+static void
+sift_down_next_event_heap(SmfFile *smf, int index)
+{
+	int child, length = smf->next_event_heap->len;
+	SmfTrack **tracks = (SmfTrack **)smf->next_event_heap->pdata;
+	SmfTrack *track = tracks[index];
+
+	for (;;) {
+		child = 2 * index + 1;
+		if (child >= length)
+			break;
+
+		if (child + 1 < length && track_plays_before(tracks[child + 1], tracks[child]))
+			child++;
+
+		if (!track_plays_before(tracks[child], track))
+			break;
+
+		tracks[index] = tracks[child];
+		index = child;
+	}
+
+	tracks[index] = track;
+}
+
+/*
+ * Puts all the tracks that have events left into smf->next_event_heap.  Takes linear time.
+ * Events of lazily loaded tracks are not needed for that; they get parsed once played.
+ */
+static void
+rebuild_next_event_heap(SmfFile *smf)
+{
+	int i;
+	SmfTrack *track;
+
+	if (smf->next_event_heap == NULL)
+		smf->next_event_heap = g_ptr_array_sized_new(smf->number_of_tracks);
+
+	g_ptr_array_set_size(smf->next_event_heap, 0);
+
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i);
+
+		if (track->next_event_number != -1)
+			g_ptr_array_add(smf->next_event_heap, track);
+	}
+
+	for (i = smf->next_event_heap->len / 2 - 1; i >= 0; i--)
+		sift_down_next_event_heap(smf, i);
+
+	smf->next_event_heap_valid = 1;
+}
+
+/*
+ * Returns 1 iff entry "a" of the timeline should be played before "b"; same order as track_plays_before().
+ */
+static int
+entry_plays_before(const struct smf_timeline_entry *a, const struct smf_timeline_entry *b)
+{
+	if (a->time_pulses != b->time_pulses)
+		return (a->time_pulses < b->time_pulses);
 
-	return (0);
+	return (a->track->track_number < b->track->track_number);
 }
 
-/**
- * smf_file_set_ppqn:
- * @smf: the SMF
- * @ppqn: New PPQN
- *
- * Sets the PPQN ("Division") field of MThd header.  This is mandatory, you
- * should call it right after smf_new.  Note that changing PPQN will change time_seconds
- * of all the events.
+/*
+ * Internal:
  *
- * Returns: 0 if everything went ok, nonzero otherwise.
+ * Same as sift_down_next_event_heap(), for heap of "length" next events of the tracks, used by
+ * build_timeline() and by smf_tempo.c when it recomputes ->time_seconds.
  */
-int
-smf_file_set_ppqn(SmfFile *smf, int ppqn)
+void
+smf_sift_down_timeline_entries(struct smf_timeline_entry *entries, int length, int index)
 {
-	assert(ppqn > 0);
+	int child;
+	struct smf_timeline_entry entry = entries[index];
 
-	smf->ppqn = ppqn;
+	for (;;) {
+		child = 2 * index + 1;
+		if (child >= length)
+			break;
 
-	return (0);
+		if (child + 1 < length && entry_plays_before(&entries[child + 1], &entries[child]))
+			child++;
+
+		if (!entry_plays_before(&entries[child], &entry))
+			break;
+
+		entries[index] = entries[child];
+		index = child;
+	}
+
+	entries[index] = entry;
 }
 
-/**
- * smf_track_get_next_event:
- * @track: the track
- *
- * Returns next event from the track given and advances next event counter.
- * Do not depend on End Of Track event being the last event on the track - it
- * is possible that the track will not end with EOT if you haven't added it
- * yet.  EOTs are added automatically during smf_file_save().
- *
- * Returns: #SmfEvent or %NULL, if there are no more events left in this track.
+/*
+ * Fills smf->timeline by merging events of all the tracks, the way smf_file_get_next_event() does
+ * after smf_file_rewind(), without moving the tracks.  Takes O(N log T) time.
  */
-SmfEvent *
-smf_track_get_next_event(SmfTrack *track)
+static void
+build_timeline(SmfFile *smf)
 {
-	SmfEvent *event, *next_event;
+	int i, length = 0, number_of_events = 0;
+	SmfTrack *track;
+	struct smf_timeline_entry *heap, *entry;
 
-	/* End of track? */
-	if (track->next_event_number == -1)
-		return (NULL);
+	heap = g_new(struct smf_timeline_entry, smf->number_of_tracks + 1);
 
-	assert(track->next_event_number >= 1);
-	assert(track->number_of_events > 0);
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_file_get_track_by_number(smf, i);
 
-	event = smf_track_get_event_by_number(track, track->next_event_number);
+		if (track->number_of_events == 0)
+			continue;
 
-	assert(event != NULL);
+		heap[length].track = track;
+		heap[length].event_number = 1;
+		heap[length].time_pulses = event_time_pulses(track, 1);
+		length++;
 
-	/* Is this the last event in the track? */
-	if (track->next_event_number < track->number_of_events) {
-		next_event = smf_track_get_event_by_number(track, track->next_event_number + 1);
-		assert(next_event);
+		number_of_events += track->number_of_events;
+	}
 
-		track->time_of_next_event = next_event->time_pulses;
-		track->next_event_number++;
-	} else {
-		track->next_event_number = -1;
+	for (i = length / 2 - 1; i >= 0; i--)
+		smf_sift_down_timeline_entries(heap, length, i);
+
+	if (smf->timeline == NULL)
+		smf->timeline = g_array_sized_new(FALSE, FALSE, sizeof(struct smf_timeline_entry), number_of_events);
+
+	g_array_set_size(smf->timeline, number_of_events);
+	entry = (struct smf_timeline_entry *)smf->timeline->data;
+
+	while (length > 0) {
+		*entry = heap[0];
+		entry->time_seconds = event_time_seconds(entry->track, entry->event_number);
+		entry++;
+
+		if (heap[0].event_number < heap[0].track->number_of_events) {
+			heap[0].event_number++;
+			heap[0].time_pulses = event_time_pulses(heap[0].track, heap[0].event_number);
+		} else {
+			heap[0] = heap[--length];
+		}
+
+		if (length > 0)
+			smf_sift_down_timeline_entries(heap, length, 0);
 	}
 
-	return (event);
+	g_free(heap);
+
+	smf->timeline_valid = 1;
+	smf->timeline_generation = smf->tempo_generation;
 }
 
-/**
- * smf_track_peek_next_event:
- * @track: the track
- *
- * Returns next event from the track given.  Does not change next event counter,
- * so repeatedly calling this routine will return the same event.
- *
- * Returns: #SmfEvent or %NULL, if there are no more events left in this track.
+/*
+ * Returns 1 iff smf->timeline is enabled and up to date, building it if needed.  It is not
+ * built while the tempo map is out of date, see smf_file_begin_edit(), as ->time_seconds are too.
  */
-static SmfEvent *
-smf_track_peek_next_event(SmfTrack *track)
+static int
+timeline_is_usable(SmfFile *smf)
 {
-	SmfEvent *event;
+	if (!smf->use_timeline_index)
+		return (0);
 
-	/* End of track? */
-	if (track->next_event_number == -1)
-		return (NULL);
+	if (smf->timeline_valid && smf->timeline_generation == smf->tempo_generation)
+		return (1);
 
-	assert(track->next_event_number >= 1);
-	assert(track->events_array->len != 0);
+	if (smf->tempo_map_dirty)
+		return (0);
 
-	event = smf_track_get_event_by_number(track, track->next_event_number);
+	build_timeline(smf);
 
-	return (event);
+	return (1);
 }
 
-/**
- * smf_file_get_track_by_number:
- * @smf: the SMF
- * @track_number: number of track to get
- *
- * Returns: Track with a given number or NULL, if there is no such track.
- *          Tracks are numbered consecutively starting from one.
+/*
+ * Returns index of the first entry of the timeline that happens at "pulses" - or at "seconds",
+ * if "pulses" is negative - or later, or length of the timeline if there is none.
  */
-SmfTrack *
-smf_file_get_track_by_number(const SmfFile *smf, int track_number)
+static int
+find_first_entry_at_or_after(const SmfFile *smf, int pulses, double seconds)
 {
-	SmfTrack *track;
+	int low = 0, high = smf->timeline->len, middle;
+	const struct smf_timeline_entry *entries = (const struct smf_timeline_entry *)smf->timeline->data;
 
-	assert(track_number >= 1);
+	while (low < high) {
+		middle = low + (high - low) / 2;
 
-	if (track_number > smf->number_of_tracks)
-		return (NULL);
+		if (pulses >= 0 ? entries[middle].time_pulses < pulses : entries[middle].time_seconds < seconds)
+			low = middle + 1;
+		else
+			high = middle;
+	}
 
-	track = (SmfTrack *)g_ptr_array_index(smf->tracks_array, track_number - 1);
+	return (low);
+}
 
-	assert(track);
+/*
+ * Returns index of the entry of the timeline for the event, or -1 if it is not there.
+ */
+static int
+find_entry_for_event(const SmfFile *smf, SmfEvent *event)
+{
+	int i, track_number, event_number;
+	const struct smf_timeline_entry *entries = (const struct smf_timeline_entry *)smf->timeline->data;
 
-	return (track);
+	track_number = smf_event_get_track_number(event);
+	event_number = smf_event_get_event_number(event);
+
+	/* Events that happen at the same time are ordered by track number, then by event number. */
+	for (i = find_first_entry_at_or_after(smf, event->time_pulses, 0.0); i < smf->timeline->len; i++) {
+		if (entries[i].time_pulses != event->time_pulses || entries[i].track->track_number > track_number)
+			break;
+
+		if (entries[i].track->track_number == track_number && entries[i].event_number == event_number)
+			return (i);
+	}
+
+	return (-1);
 }
 
-/**
- * smf_track_get_event_by_number:
- * @track: the track
- * @event_number: event number to retrieve
- *
- * Returns: Event with a given number or NULL, if there is no such event.
- *   Events are numbered consecutively starting from one.
+/*
+ * Positions every track where it would be after smf_file_get_next_event() returned all the events
+ * in the timeline before "position": at its first event that plays after the one at "position".
  */
-SmfEvent *
-smf_track_get_event_by_number(const SmfTrack *track, int event_number)
+static void
+seek_tracks_to_timeline_position(SmfFile *smf, int position)
 {
-	SmfEvent *event;
+	int i, event_number;
+	SmfTrack *track;
+	const struct smf_timeline_entry *entry = NULL;
 
-	assert(event_number >= 1);
+	if (position < smf->timeline->len)
+		entry = &g_array_index(smf->timeline, struct smf_timeline_entry, position);
 
-	if (event_number > track->number_of_events)
-		return (NULL);
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_file_get_track_by_number(smf, i);
 
-	event = g_ptr_array_index(track->events_array, event_number - 1);
+		if (entry == NULL)
+			event_number = -1;
+		else if (i < entry->track->track_number)
+			event_number = smf_track_find_first_event_at_or_after(track, entry->time_pulses + 1, 0.0);
+		else if (i == entry->track->track_number)
+			event_number = entry->event_number;
+		else
+			event_number = smf_track_find_first_event_at_or_after(track, entry->time_pulses, 0.0);
 
-	assert(event);
+		track->next_event_number = event_number;
+		if (event_number != -1)
+			track->time_of_next_event = event_time_pulses(track, event_number);
+	}
 
-	return (event);
+	smf->next_event_heap_valid = 0;
+	smf->timeline_position = position;
 }
 
 /**
- * smf_track_get_last_event:
- * @track: the track
+ * smf_file_set_timeline_index:
+ * @smf: the SMF
+ * @use_timeline_index: nonzero to keep all the events of the song in playback order
  *
- * Returns: Last event on the track or NULL, if track is empty.
+ * Makes smf_file_get_next_event() and smf_file_peek_next_event() take the next event from
+ * an array of all the events of the song, in the order they would normally return them,
+ * instead of merging the tracks every time; seeking becomes a binary search in that array.
+ * Worth it when the same song is played repeatedly.  The array gets built when needed, and
+ * built again after events or tracks are added or removed, or the tempo map changes.
+ * Until the next smf_file_rewind() or seek, playback falls back to merging the tracks after
+ * that, or after tracks are advanced on their own, e.g. by smf_track_get_next_event().
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ *
+ * Since: 1.4
  */
-SmfEvent *
-smf_track_get_last_event(const SmfTrack *track)
+int
+smf_file_set_timeline_index(SmfFile *smf, int use_timeline_index)
 {
-	SmfEvent *event;
+	smf->use_timeline_index = !!use_timeline_index;
 
-	if (track->number_of_events == 0)
-		return (NULL);
-       
-	event = smf_track_get_event_by_number(track, track->number_of_events);
+	if (!smf->use_timeline_index && smf->timeline != NULL) {
+		g_array_free(smf->timeline, TRUE);
+		smf->timeline = NULL;
+		smf->timeline_valid = 0;
+	}
 
-	return (event);
+	return (0);
 }
 
 /**
@@ -1067,32 +3005,31 @@ smf_track_get_last_event(const SmfTrack *track)
 SmfTrack *
 smf_file_find_track_with_next_event(SmfFile *smf)
 {
-	int i, min_time = 0;
-	SmfTrack *track = NULL, *min_time_track = NULL;
-
-	/* Find track with event that should be played next. */
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		track = smf_get_track_by_number(smf, i);
+	if (smf->timeline_position != -1 && timeline_is_usable(smf)) {
+		if (smf->timeline_position == smf->timeline->len)
+			return (NULL);
 
-		assert(track);
+		return (g_array_index(smf->timeline, struct smf_timeline_entry, smf->timeline_position).track);
+	}
 
-		/* No more events in this track? */
-		if (track->next_event_number == -1)
-			continue;
+	if (!smf->next_event_heap_valid)
+		rebuild_next_event_heap(smf);
 
-		if (track->time_of_next_event < min_time || min_time_track == NULL) {
-			min_time = track->time_of_next_event;
-			min_time_track = track;
-		}
-	}
+	if (smf->next_event_heap->len == 0)
+		return (NULL);
 
-	return (min_time_track);
+	return (g_ptr_array_index(smf->next_event_heap, 0));
 }
 
 /**
  * smf_file_get_next_event:
  * @smf: the SMF
  *
+ * Merges events of all the tracks; every call takes time logarithmic in the number of tracks
+ * that have events left, as long as their positions are not changed in between, e.g. by
+ * smf_track_get_next_event() or smf_file_rewind().  With smf_file_set_timeline_index(),
+ * it takes constant time instead.
+ *
  * Returns: Next event, in time order, or NULL, if there are none left.
  */
 SmfEvent *
@@ -1109,11 +3046,29 @@ smf_file_get_next_event(SmfFile *smf)
 		return (NULL);
 	}
 
-	event = smf_track_get_next_event(track);
+	event = advance_track(track);
 	
 	assert(event != NULL);
 
-	event->track->smf->last_seek_position = -1.0;
+	/* Unless parsing pending events of the track failed, it was at the position from the timeline. */
+	if (smf->timeline_position != -1 && smf->timeline_valid) {
+		assert(g_array_index(smf->timeline, struct smf_timeline_entry, smf->timeline_position).event_number ==
+		    smf_event_get_event_number(event));
+
+		smf->timeline_position++;
+		smf->next_event_heap_valid = 0;
+	}
+
+	/* Track is still at the top of the heap, unless parsing its pending events failed. */
+	if (smf->next_event_heap_valid) {
+		if (track->next_event_number == -1)
+			g_ptr_array_remove_index_fast(smf->next_event_heap, 0);
+
+		if (smf->next_event_heap->len > 0)
+			sift_down_next_event_heap(smf, 0);
+	}
+
+	smf->last_seek_position = -1.0;
 
 	return (event);
 }
@@ -1174,11 +3129,11 @@ smf_file_rewind(SmfFile *smf)
 {
 	int i;
 	SmfTrack *track = NULL;
-	SmfEvent *event;
 
 	assert(smf);
 
 	smf->last_seek_position = 0.0;
+	smf->next_event_heap_valid = 0;
 
 	for (i = 1; i <= smf->number_of_tracks; i++) {
 		track = smf_file_get_track_by_number(smf, i);
@@ -1187,9 +3142,7 @@ smf_file_rewind(SmfFile *smf)
 
 		if (track->number_of_events > 0) {
 			track->next_event_number = 1;
-			event = smf_track_peek_next_event(track);
-			assert(event);
-			track->time_of_next_event = event->time_pulses;
+			track->time_of_next_event = event_time_pulses(track, 1);
 		} else {
 			track->next_event_number = -1;
 			track->time_of_next_event = 0;
@@ -1198,6 +3151,8 @@ smf_file_rewind(SmfFile *smf)
 #endif
 		}
 	}
+
+	smf->timeline_position = 0;
 }
 
 /**
@@ -1213,8 +3168,21 @@ smf_file_rewind(SmfFile *smf)
 int
 smf_file_seek_to_event(SmfFile *smf, const SmfEvent *target)
 {
+	int position;
 	SmfEvent *event;
 
+	if (timeline_is_usable(smf)) {
+		position = find_entry_for_event(smf, (SmfEvent *)target);
+
+		/* There can't be -1 here, unless "target" is not in this smf. */
+		assert(position != -1);
+
+		seek_tracks_to_timeline_position(smf, position);
+		smf->last_seek_position = g_array_index(smf->timeline, struct smf_timeline_entry, position).time_seconds;
+
+		return (0);
+	}
+
 	smf_rewind(smf);
 
 #if 0
@@ -1238,6 +3206,38 @@ smf_file_seek_to_event(SmfFile *smf, const SmfEvent *target)
 	return (0);
 }
 
+/*
+ * Positions every track at its first event that happens at "pulses" - or at "seconds", if "pulses"
+ * is negative - or later.  Same as skipping events until smf_file_peek_next_event() returns such
+ * an event, just using binary search in every track instead of walking through all the events.
+ * Returns: The next event, or NULL if there are none left.
+ */
+static SmfEvent *
+seek_tracks(SmfFile *smf, int pulses, double seconds)
+{
+	int i, event_number;
+	SmfTrack *track;
+
+	smf->next_event_heap_valid = 0;
+	smf->timeline_position = -1;
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_file_get_track_by_number(smf, i);
+
+		event_number = smf_track_find_first_event_at_or_after(track, pulses, seconds);
+
+		track->next_event_number = event_number;
+		if (event_number != -1)
+			track->time_of_next_event = event_time_pulses(track, event_number);
+	}
+
+	/* Tracks end up just like they would at that point of the timeline. */
+	if (timeline_is_usable(smf))
+		smf->timeline_position = find_first_entry_at_or_after(smf, pulses, seconds);
+
+	return (smf_file_peek_next_event(smf));
+}
+
 /**
  * smf_file_seek_to_seconds:
  * @smf: the SMF
@@ -1268,18 +3268,10 @@ smf_file_seek_to_seconds(SmfFile *smf, double seconds)
 	g_debug("Seeking to %f seconds.", seconds);
 #endif
 
-	for (;;) {
-		event = smf_file_peek_next_event(smf);
-
-		if (event == NULL) {
-			g_critical("Trying to seek past the end of song.");
-			return (-1);
-		}
-
-		if (event->time_seconds < seconds)
-			smf_skip_next_event(smf);
-		else
-			break;
+	event = seek_tracks(smf, -1, seconds);
+	if (event == NULL) {
+		g_critical("Trying to seek past the end of song.");
+		return (-1);
 	}
 
 	smf->last_seek_position = seconds;
@@ -1310,18 +3302,10 @@ smf_file_seek_to_pulses(SmfFile *smf, int pulses)
 	g_debug("Seeking to %d pulses.", pulses);
 #endif
 
-	for (;;) {
-		event = smf_file_peek_next_event(smf);
-
-		if (event == NULL) {
-			g_critical("Trying to seek past the end of song.");
-			return (-1);
-		}
-
-		if (event->time_pulses < pulses)
-			smf_skip_next_event(smf);
-		else
-			break;
+	event = seek_tracks(smf, pulses, 0.0);
+	if (event == NULL) {
+		g_critical("Trying to seek past the end of song.");
+		return (-1);
 	}
 
 	smf->last_seek_position = event->time_seconds;
@@ -1329,6 +3313,53 @@ smf_file_seek_to_pulses(SmfFile *smf, int pulses)
 	return (0);
 }
 
+/*
+ * Internal:
+ *
+ * Returns: time_pulses of the last event in the track, or -1 if the track is empty.
+ *   Does not need to parse events of lazily loaded tracks.
+ */
+int
+smf_track_length_pulses(const SmfTrack *track)
+{
+	if (track->number_of_events == 0)
+		return (-1);
+
+	if (track->events_pending)
+		return (track->chunk_length_pulses);
+
+	return (event_time_pulses(track, track->number_of_events));
+}
+
+/*
+ * Internal:
+ *
+ * Updates the cached length of the song after smf_track_length_pulses() of one of its tracks
+ * changed from "old_pulses" to "new_pulses"; -1 stands for an empty track, or one that is not
+ * part of the song.  When the last of the tracks holding the last event gets shorter, the length
+ * has to be found again; that is left to smf_file_get_length_pulses().
+ */
+void
+smf_file_track_length_changed(SmfFile *smf, int old_pulses, int new_pulses)
+{
+	if (smf == NULL || !smf->length_valid || old_pulses == new_pulses)
+		return;
+
+	if (new_pulses > smf->length_pulses) {
+		smf->length_pulses = new_pulses;
+		smf->tracks_at_length = 1;
+		return;
+	}
+
+	if (new_pulses >= 0 && new_pulses == smf->length_pulses) {
+		smf->tracks_at_length++;
+	} else if (old_pulses >= 0 && old_pulses == smf->length_pulses) {
+		smf->tracks_at_length--;
+		if (smf->tracks_at_length == 0)
+			smf->length_valid = 0;
+	}
+}
+
 /**
  * smf_file_get_length_pulses:
  * @smf: the SMF
@@ -1338,25 +3369,30 @@ smf_file_seek_to_pulses(SmfFile *smf, int pulses)
 int
 smf_file_get_length_pulses(const SmfFile *smf)
 {
-	int pulses = 0, i;
+	int i, track_pulses;
+	SmfFile *tmp = (SmfFile *)smf;
 
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		SmfTrack *track;
-		SmfEvent *event;
+	/* Kept up to date by smf_file_track_length_changed(), if known. */
+	if (smf->length_valid)
+		return (smf->length_pulses);
 
-	       	track = smf_file_get_track_by_number(smf, i);
-		assert(track);
+	tmp->length_pulses = 0;
+	tmp->tracks_at_length = 0;
 
-		event = smf_track_get_last_event(track);
-		/* Empty track? */
-		if (event == NULL)
-			continue;
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track_pulses = smf_track_length_pulses(g_ptr_array_index(smf->tracks_array, i));
 
-		if (event->time_pulses > pulses)
-			pulses = event->time_pulses;
+		if (track_pulses > tmp->length_pulses) {
+			tmp->length_pulses = track_pulses;
+			tmp->tracks_at_length = 1;
+		} else if (track_pulses == tmp->length_pulses) {
+			tmp->tracks_at_length++;
+		}
 	}
 
-	return (pulses);
+	tmp->length_valid = 1;
+
+	return (smf->length_pulses);
 }
 
 /**
@@ -1368,26 +3404,22 @@ smf_file_get_length_pulses(const SmfFile *smf)
 double
 smf_file_get_length_seconds(const SmfFile *smf)
 {
-	int i;
-	double seconds = 0.0;
+	int pulses;
+	SmfFile *tmp = (SmfFile *)smf;
 
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		SmfTrack *track;
-		SmfEvent *event;
-
-	       	track = smf_file_get_track_by_number(smf, i);
-		assert(track);
+	pulses = smf_file_get_length_pulses(smf);
 
-		event = smf_track_get_last_event(track);
-		/* Empty track? */
-		if (event == NULL)
-			continue;
+	if (smf->length_seconds_valid && smf->length_seconds_pulses == pulses &&
+	    smf->length_seconds_generation == smf->tempo_generation)
+		return (smf->length_seconds);
 
-		if (event->time_seconds > seconds)
-			seconds = event->time_seconds;
-	}
+	/* Same as ->time_seconds of the last event, without looking at it. */
+	tmp->length_seconds = seconds_from_pulses(smf, pulses);
+	tmp->length_seconds_pulses = pulses;
+	tmp->length_seconds_generation = smf->tempo_generation;
+	tmp->length_seconds_valid = 1;
 
-	return (seconds);
+	return (smf->length_seconds);
 }
 
 /**
@@ -143,8 +143,13 @@
  * last one, you specify it as seconds from the start of the song.  Obviously, the first version can
  * only append events at the end of the track.
  *
+ * To add many events at once, e.g. when generating or importing a song, use smf_track_add_events_pulses()
+ * or smf_track_add_events_seconds().  These take events in any order and are much faster than adding
+ * them one by one.
+ *
  * To remove an event from the track it's attached to, use smf_track_remove_event().  You may
- * want to free the event (using smf_event_delete()) afterwards.
+ * want to free the event (using smf_event_delete()) afterwards.  To remove many events at once,
+ * use smf_track_remove_events_if() or smf_file_remove_events_if().
  *
  * To create new track, use smf_track_new().  To add track to the smf, use smf_file_add_track().
  * To remove track from its smf, use smf_file_remove_track().  To free the track structure,
@@ -155,7 +160,9 @@
  * the track, free it etc.
  *
  * Tracks and events are numbered consecutively, starting from one.  If you remove a track or event,
- * the rest of tracks/events will get renumbered.  To get the number of a given event in its track, use #SmfEvent.event_number.
+ * the rest of tracks/events will get renumbered.  To get the number of a given event in its track, use
+ * smf_event_get_event_number(); #SmfEvent.event_number is only right until events get added or removed.
+ * To get the number of the track an event is in, use smf_event_get_track_number().
  * To get the number of track in its smf, use #SmfTrack.track_number.  To get the number of events in the track,
  * use #SmfTrack.number_of_events.  To get the number of tracks in the smf, use #SmfFile.number_of_tracks.
  *
@@ -209,12 +216,15 @@ extern "C" {
 
 #include <stdio.h>
 #include <glib.h>
+#include <gio/gio.h>
 
 
 typedef struct _SmfFile  SmfFile;
 typedef struct _SmfTempo SmfTempo;
 typedef struct _SmfTrack SmfTrack;
 typedef struct _SmfEvent SmfEvent;
+typedef struct _SmfParser SmfParser;
+typedef struct _SmfProbe SmfProbe;
 
 #if HAVE_INTROSPECTION
 #include <glib-object.h>
@@ -223,6 +233,8 @@ GType smf_file_get_type  (void) G_GNUC_CONST;
 GType smf_track_get_type  (void) G_GNUC_CONST;
 GType smf_tempo_get_type  (void) G_GNUC_CONST;
 GType smf_event_get_type  (void) G_GNUC_CONST;
+GType smf_parser_get_type  (void) G_GNUC_CONST;
+GType smf_probe_get_type  (void) G_GNUC_CONST;
 #endif /* HAVE_INTROSPECTION */
 
 /**
@@ -256,15 +268,63 @@ struct _SmfFile {
 	/* Array of pointers to smf_tempo_struct. */
 	GPtrArray	*tempo_array;
 	int		ref_count;
+
+	/*< private >*/
+	/* Mapping of the file this SMF was loaded from by smf_file_load_mmap(), or %NULL. */
+	GMappedFile	*mapped_file;
+
+	/*< private >*/
+	/* Nesting level of smf_file_begin_edit(); tempo map gets updated when it drops to zero, if dirty. */
+	int		edit_depth;
+	int		tempo_map_dirty;
+	/* If dirty, tempo map is out of date starting from this time. */
+	int		tempo_map_dirty_pulses;
+
+	/*< private >*/
+	/* Set by smf_file_set_lazy_seconds(). */
+	int		lazy_seconds;
+	/* Changes whenever the tempo map does; see SmfEvent.seconds_generation. */
+	unsigned int	tempo_generation;
+
+	/*< private >*/
+	/* Cached smf_file_get_length_pulses(), and number of tracks whose last event is at that time. */
+	int		length_valid;
+	int		length_pulses;
+	int		tracks_at_length;
+	/* Cached smf_file_get_length_seconds(), valid if neither the length nor the tempo map changed since. */
+	int		length_seconds_valid;
+	int		length_seconds_pulses;
+	unsigned int	length_seconds_generation;
+	double		length_seconds;
+
+	/*< private >*/
+	/* Tracks with events left, as a binary min-heap ordered by time of the next event and track number;
+	   see smf_file_get_next_event().  Rebuilt from scratch when not valid. */
+	GPtrArray	*next_event_heap;
+	int		next_event_heap_valid;
+
+	/*< private >*/
+	/* Set by smf_file_set_timeline_index(): all the events, in smf_file_get_next_event() order, as GArray
+	   of struct smf_timeline_entry.  Valid if no events were added or removed since it was built, and
+	   tempo map is still at timeline_generation.  Position of the next event in it, or -1 if unknown,
+	   e.g. because a track was advanced on its own. */
+	int		use_timeline_index;
+	GArray		*timeline;
+	int		timeline_valid;
+	unsigned int	timeline_generation;
+	int		timeline_position;
 };
 
 /* Routines for manipulating SmfFile. */
 SmfFile *smf_file_new(void) G_GNUC_WARN_UNUSED_RESULT;
 SmfFile *smf_file_ref(SmfFile *smf) G_GNUC_WARN_UNUSED_RESULT;
 void smf_file_unref(SmfFile *smf);
+SmfFile *smf_file_clone(SmfFile *smf) G_GNUC_WARN_UNUSED_RESULT;
 
 int smf_file_set_format(SmfFile *smf, int format) G_GNUC_WARN_UNUSED_RESULT;
 int smf_file_set_ppqn(SmfFile *smf, int ppqn) G_GNUC_WARN_UNUSED_RESULT;
+int smf_file_set_lazy_seconds(SmfFile *smf, int lazy_seconds) G_GNUC_WARN_UNUSED_RESULT;
+int smf_file_set_timeline_index(SmfFile *smf, int use_timeline_index) G_GNUC_WARN_UNUSED_RESULT;
 
 char *smf_file_decode(const SmfFile *smf) G_GNUC_WARN_UNUSED_RESULT;
 
@@ -288,9 +348,99 @@ void smf_file_remove_track(SmfFile *smf, SmfTrack *track);
 /* Routines for loading SMF files. */
 SmfFile *smf_file_load(const char *file_name) G_GNUC_WARN_UNUSED_RESULT;
 SmfFile *smf_file_load_from_memory(const void *buffer, const int buffer_length) G_GNUC_WARN_UNUSED_RESULT;
+SmfFile *smf_file_load_mmap(const char *file_name) G_GNUC_WARN_UNUSED_RESULT;
+SmfFile *smf_file_load_lazy(const char *file_name) G_GNUC_WARN_UNUSED_RESULT;
+SmfFile *smf_file_load_parallel(const char *file_name, int max_threads) G_GNUC_WARN_UNUSED_RESULT;
+void smf_file_load_async(const char *file_name, GCancellable *cancellable, GAsyncReadyCallback callback,
+	gpointer user_data);
+SmfFile *smf_file_load_finish(GAsyncResult *result, GError **error) G_GNUC_WARN_UNUSED_RESULT;
+SmfFile *smf_file_load_from_memory_parallel(const void *buffer, const int buffer_length, int max_threads) G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * SmfFileNameFunc:
+ * @user_data: data passed to smf_file_load_many_from_func()
+ *
+ * Returns: path of the next file, or %NULL when there are no more files.  It has to stay valid
+ *   only until the next call.
+ */
+typedef const char *(*SmfFileNameFunc)(gpointer user_data);
+
+/**
+ * SmfFileLoadManyFunc:
+ * @file_name: path of the file
+ * @smf: (transfer full) (allow-none): loaded SMF, or %NULL if loading failed
+ * @error: (allow-none): reason of the failure, or %NULL
+ * @user_data: data passed to smf_file_load_many()
+ */
+typedef void (*SmfFileLoadManyFunc)(const char *file_name, SmfFile *smf, const GError *error, gpointer user_data);
+
+int smf_file_load_many(const char **file_names, int number_of_files, int max_threads, int max_in_flight,
+	SmfFileLoadManyFunc func, gpointer user_data);
+int smf_file_load_many_from_func(SmfFileNameFunc next_file_name, gpointer next_file_name_data,
+	int max_threads, int max_in_flight, SmfFileLoadManyFunc func, gpointer user_data);
+int smf_file_evict_untouched_tracks(SmfFile *smf);
+
+/**
+ * SmfProbe:
+ * @format: Format of the file, as in #SmfFile.
+ * @ppqn: Timing, as in #SmfFile.
+ * @frames_per_second: Timing, as in #SmfFile.
+ * @resolution: Timing, as in #SmfFile.
+ * @number_of_tracks: Number of tracks.
+ * @length_pulses: Length of the song, as returned by smf_file_get_length_pulses().
+ * @length_seconds: Length of the song, as returned by smf_file_get_length_seconds().
+ * @track_names: (array zero-terminated=1): Names of the tracks, taken from their first
+ *   Sequence/Track Name metaevent, or empty strings for the tracks without one.
+ *
+ * Basic information about SMF file, as returned by smf_file_probe().
+ */
+struct _SmfProbe {
+	int		format;
+	int		ppqn;
+	int		frames_per_second;
+	int		resolution;
+	int		number_of_tracks;
+	int		length_pulses;
+	double		length_seconds;
+	char		**track_names;
+
+	/*< private >*/
+	int		ref_count;
+};
+
+SmfProbe *smf_file_probe(const char *file_name) G_GNUC_WARN_UNUSED_RESULT;
+SmfProbe *smf_probe_ref(SmfProbe *probe) G_GNUC_WARN_UNUSED_RESULT;
+void smf_probe_unref(SmfProbe *probe);
+
+/**
+ * SmfParserEventFunc:
+ * @event: event that was just parsed and added to its track
+ * @user_data: data passed to smf_parser_set_event_func()
+ */
+typedef void (*SmfParserEventFunc)(SmfEvent *event, gpointer user_data);
+
+/**
+ * SmfParserTrackFunc:
+ * @track: track whose events were all parsed
+ * @user_data: data passed to smf_parser_set_track_func()
+ */
+typedef void (*SmfParserTrackFunc)(SmfTrack *track, gpointer user_data);
+
+/* Routines for loading SMF files incrementally. */
+SmfParser *smf_parser_new(void) G_GNUC_WARN_UNUSED_RESULT;
+SmfParser *smf_parser_ref(SmfParser *parser) G_GNUC_WARN_UNUSED_RESULT;
+void smf_parser_unref(SmfParser *parser);
+void smf_parser_set_event_func(SmfParser *parser, SmfParserEventFunc func, gpointer user_data, GDestroyNotify notify);
+void smf_parser_set_track_func(SmfParser *parser, SmfParserTrackFunc func, gpointer user_data, GDestroyNotify notify);
+SmfFile *smf_parser_get_file(SmfParser *parser) G_GNUC_WARN_UNUSED_RESULT;
+int smf_parser_feed(SmfParser *parser, const void *buffer, const int buffer_length) G_GNUC_WARN_UNUSED_RESULT;
+SmfFile *smf_parser_finish(SmfParser *parser) G_GNUC_WARN_UNUSED_RESULT;
 
 /* Routine for writing SMF files. */
 int smf_file_save(SmfFile *smf, const char *file_name) G_GNUC_WARN_UNUSED_RESULT;
+void smf_file_save_async(SmfFile *smf, const char *file_name, GCancellable *cancellable,
+	GAsyncReadyCallback callback, gpointer user_data);
+gboolean smf_file_save_finish(GAsyncResult *result, GError **error);
 
 /* Routines for manipulating SmfTempo. */
 SmfTempo *smf_file_get_tempo_by_pulses(const SmfFile *smf, int pulses) G_GNUC_WARN_UNUSED_RESULT;
@@ -301,7 +451,9 @@ SmfTempo *smf_file_get_last_tempo(const SmfFile *smf) G_GNUC_WARN_UNUSED_RESULT;
 
 /**
  * SmfTrack:
- * @events_array: (element-type Smf.Event):
+ * @events_array: (element-type Smf.Event): Events of the track.  After smf_track_compact(), events not
+ *   asked for yet are %NULL here, and so are some entries between smf_file_begin_edit() and
+ *   smf_file_end_edit(); use smf_track_get_event_by_number() to access them.
  * Represents a single track.
  */
 struct _SmfTrack {
@@ -333,6 +485,26 @@ struct _SmfTrack {
 
 	/*< private >*/
 	int		ref_count;
+
+	/* Used by smf_file_load_lazy(): location of MTrk chunk in smf->mapped_file, time of its last event,
+	   and whether events are yet to be parsed, were accessed since the last smf_file_evict_untouched_tracks()
+	   and were modified after parsing. */
+	int		chunk_offset;
+	int		chunk_length;
+	int		chunk_length_pulses;
+	int		events_pending;
+	int		events_touched;
+	int		events_modified;
+
+	/* Set by smf_track_compact(): times and MIDI data of all the events, see smf_private.h.  While
+	   it is set, events_array entries are %NULL until the event is asked for. */
+	struct smf_event_columns	*columns;
+
+	/* Between smf_file_begin_edit() and smf_file_end_edit(), events_array may contain a gap of
+	   "gap_length" %NULL entries starting at "gap_start", so that adding and removing events close
+	   to each other does not need to move all the following ones; see smf_track_event_at(). */
+	int		gap_start;
+	int		gap_length;
 };
 
 /* Routines for manipulating SmfTrack. */
@@ -340,19 +512,38 @@ SmfTrack *smf_track_new(void) G_GNUC_WARN_UNUSED_RESULT;
 void smf_track_delete(SmfTrack *track);
 SmfTrack *smf_track_ref(SmfTrack *track) G_GNUC_WARN_UNUSED_RESULT;
 void smf_track_unref(SmfTrack *track);
+SmfTrack *smf_track_clone(SmfTrack *track) G_GNUC_WARN_UNUSED_RESULT;
 
 SmfEvent *smf_track_get_next_event(SmfTrack *track) G_GNUC_WARN_UNUSED_RESULT;
 SmfEvent *smf_track_get_event_by_number(const SmfTrack *track, int event_number) G_GNUC_WARN_UNUSED_RESULT;
 SmfEvent *smf_track_get_last_event(const SmfTrack *track) G_GNUC_WARN_UNUSED_RESULT;
+int smf_track_compact(SmfTrack *track);
+int smf_file_compact(SmfFile *smf);
 
 void smf_track_add_event_delta_pulses(SmfTrack *track, SmfEvent *event, int delta);
 void smf_track_add_event_pulses(SmfTrack *track, SmfEvent *event, int pulses);
 void smf_track_add_event_seconds(SmfTrack *track, SmfEvent *event, double seconds);
+void smf_track_add_events_pulses(SmfTrack *track, SmfEvent **events, const int *pulses, int number_of_events);
+void smf_track_add_events_seconds(SmfTrack *track, SmfEvent **events, const double *seconds, int number_of_events);
 int smf_track_add_eot_delta_pulses(SmfTrack *track, int delta) G_GNUC_WARN_UNUSED_RESULT;
 int smf_track_add_eot_pulses(SmfTrack *track, int pulses) G_GNUC_WARN_UNUSED_RESULT;
 int smf_track_add_eot_seconds(SmfTrack *track, double seconds) G_GNUC_WARN_UNUSED_RESULT;
 void smf_track_remove_event(SmfTrack *track, SmfEvent *event);
 
+/**
+ * SmfEventFilterFunc:
+ * @event: the event
+ * @user_data: data passed to smf_track_remove_events_if() or smf_file_remove_events_if()
+ *
+ * Returns: %TRUE if @event should be removed.
+ */
+typedef gboolean (*SmfEventFilterFunc)(SmfEvent *event, gpointer user_data);
+
+int smf_track_remove_events_if(SmfTrack *track, SmfEventFilterFunc func, gpointer user_data);
+int smf_file_remove_events_if(SmfFile *smf, SmfEventFilterFunc func, gpointer user_data);
+void smf_file_begin_edit(SmfFile *smf);
+void smf_file_end_edit(SmfFile *smf);
+
 
 /**
  * SmfEvent:
@@ -365,7 +556,9 @@ void smf_track_remove_event(SmfTrack *track, SmfEvent *event);
  * @track_number: Tracks are numbered consecutively, starting from 1.
  * @midi_buffer: (array length=midi_buffer_length) (element-type guint8):
  *   Pointer to the buffer containing MIDI message. This is freed by
- *   smf_event_delete.
+ *   smf_event_delete.  Buffers allocated by libsmf itself may point into the event
+ *   or elsewhere, so never free(3) or realloc(3) them; replacing them with your own
+ *   malloc(3)ed buffer is fine.
  * @midi_buffer_length: Length of the MIDI message in the buffer, in bytes.
  * @user_pointer: API consumer is free to use this for whatever purpose.
  *   %NULL in freshly allocated event.
@@ -374,6 +567,15 @@ void smf_track_remove_event(SmfTrack *track, SmfEvent *event);
  *   the track; there is no mechanism for libsmf to notify you about removal of the event.
  *
  * Represents a single MIDI event or metaevent.
+ *
+ * @event_number, @delta_time_pulses and @track_number depend on the other events and tracks,
+ * so libsmf does not update them when these are added or removed; they are brought up to date
+ * whenever the event is returned by libsmf, e.g. by smf_track_get_event_by_number() or passed
+ * to #SmfEventFilterFunc.  To read them for an event obtained before such a change, use
+ * smf_event_get_event_number() and friends.  They are still stored in every #SmfEvent, so this
+ * does not make events any smaller; use smf_track_compact() for that.
+ * The same goes for @time_seconds after tempo changes, if smf_file_set_lazy_seconds() is in effect;
+ * use smf_event_get_time_seconds() then.
  */
 struct _SmfEvent {
 	SmfTrack	*track;
@@ -387,6 +589,18 @@ struct _SmfEvent {
 	void		*user_pointer;
 	/*< private >*/
 	int		ref_count;
+
+	/* With lazy seconds, ->time_seconds is up to date iff this equals ->tempo_generation of the smf. */
+	unsigned int	seconds_generation;
+
+	/* Set iff midi_buffer may point into a file mapping instead of malloc(3)ed memory. */
+	GMappedFile	*mapped_file;
+
+	/* Set iff the event was allocated from an arena, rather than using malloc(3). */
+	struct smf_arena_struct	*arena;
+
+	/* Storage for midi_buffer of short messages, i.e. nearly all of them. */
+	unsigned char	inline_buffer[8];
 };
 
 /* Routines for manipulating SmfEvent. */
@@ -398,6 +612,7 @@ void smf_event_delete(SmfEvent *event);
 void smf_event_remove_from_track(SmfEvent *event);
 SmfEvent *smf_event_ref(SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
 void smf_event_unref(SmfEvent *event);
+void smf_trim_event_cache(int max_cached_events);
 
 int smf_event_is_last(const SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
 int smf_event_is_valid(const SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
@@ -410,6 +625,10 @@ int smf_event_is_textual(const SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
 char *smf_event_decode(const SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
 char *smf_event_extract_text(const SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
 unsigned char *smf_event_get_buffer(SmfEvent *event, int *length);
+int smf_event_get_event_number(SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
+int smf_event_get_track_number(SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
+int smf_event_get_delta_time_pulses(SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
+double smf_event_get_time_seconds(SmfEvent *event) G_GNUC_WARN_UNUSED_RESULT;
 
 
 /**
@@ -427,6 +646,8 @@ struct _SmfTempo {
 	int notes_per_note;
 	/*< private >*/
 	int ref_count;
+	/* Which of the fields above were set by events at ->time_pulses; the rest are inherited. */
+	int set_by_events;
 };
 
 /* Routines for manipulating SmfTempo. */
@@ -83,7 +83,7 @@ smf_tempo_t *smf_get_tempo_by_pulses(const smf_t *smf, int pulses) {
 }
 
 smf_tempo_t *smf_get_tempo_by_seconds(const smf_t *smf, double seconds) {
-    return smf_get_tempo_by_seconds(smf, seconds);
+    return smf_file_get_tempo_by_seconds(smf, seconds);
 }
 smf_tempo_t *smf_get_tempo_by_number(const smf_t *smf, int number) {
     return smf_file_get_tempo_by_number(smf, number);
@@ -40,14 +40,27 @@
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
 #ifdef __MINGW32__
 #include <windows.h>
+#include <io.h>
 #else /* ! __MINGW32__ */
 #include <arpa/inet.h>
+#include <unistd.h>
 #endif /* ! __MINGW32__ */
 #include "smf.h"
 #include "smf_private.h"
 
+#ifdef HAVE_LIBURING
+#include <stdint.h>
+#include <linux/stat.h>
+#include <liburing.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 /*
  * Returns pointer to the next SMF chunk in smf->buffer, based on length of the previous one.
  * Returns NULL in case of error.
@@ -219,6 +232,14 @@ extract_vlq(const unsigned char *buf, const int buffer_length, int *value, int *
 
 	assert(buffer_length > 0);
 
+	/* Fast path; most delta times and lengths are below 128. */
+	if (!(*buf & 0x80)) {
+		*value = *buf;
+		*len = 1;
+
+		return (0);
+	}
+
 	for (;;) {
 		if (c >= buf + buffer_length) {
 			g_critical("End of buffer in extract_vlq().");
@@ -307,6 +328,50 @@ expected_escaped_length(const unsigned char status, const unsigned char *second_
 	return (expected_sysex_length(status, second_byte, buffer_length, consumed_bytes) - 1);
 }
 
+/* Special values in message_lengths[]. */
+#define MESSAGE_NOT_STATUS	0
+#define MESSAGE_SYSEX		-1
+#define MESSAGE_ESCAPE		-2
+#define MESSAGE_META		-3
+#define MESSAGE_UNKNOWN		-4
+
+/*
+ * Length of MIDI message (including the status byte), indexed by its status byte, or one of the values
+ * above if the length is not fixed or there is no such message.  Saves a few branches per event.
+ */
+static const signed char message_lengths[256] = {
+	/* 0x00 - 0x7F: data bytes. */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0x80: Note Off. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0x90: Note On. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0xA0: AfterTouch. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0xB0: Control Change. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0xC0: Program Change. */
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	/* 0xD0: Channel Pressure. */
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	/* 0xE0: Pitch Wheel. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/*
+	 * 0xF0: SysEx, MTC Quarter Frame, Song Position Pointer, Song Select, undefined, undefined,
+	 * Tune Request, escape, MIDI Clock, Tick, MIDI Start, MIDI Continue, MIDI Stop, undefined,
+	 * Active Sense, metaevent.
+	 */
+	MESSAGE_SYSEX, 2, 3, 2, MESSAGE_UNKNOWN, MESSAGE_UNKNOWN, 1, MESSAGE_ESCAPE,
+	1, 1, 1, 1, 1, MESSAGE_UNKNOWN, 1, MESSAGE_META
+};
+
 /*
  * Returns expected length of the midi message (including the status byte), in bytes, for the given status byte.
  * The "second_byte" points to the expected second byte of the MIDI message.  "buffer_length" is the buffer
@@ -341,57 +406,65 @@ expected_message_length(unsigned char status, const unsigned char *second_byte,
 		return (*(second_byte + 1) + 3);
 	}
 
+	if (message_lengths[status] > 0)
+		return (message_lengths[status]);
+
 	if ((status & 0xF0) == 0xF0) {
-		switch (status) {
-			case 0xF2: /* Song Position Pointer. */
-				return (3);
-
-			case 0xF1: /* MTC Quarter Frame. */
-			case 0xF3: /* Song Select. */
-				return (2);
-
-			case 0xF6: /* Tune Request. */
-			case 0xF8: /* MIDI Clock. */
-			case 0xF9: /* Tick. */
-			case 0xFA: /* MIDI Start. */
-			case 0xFB: /* MIDI Continue. */
-			case 0xFC: /* MIDI Stop. */
-			case 0xFE: /* Active Sense. */
-				return (1);
-
-			default:
-				g_critical("SMF error: unknown 0xFx-type status byte '0x%x'.", status);
-				return (-2);
-		}
+		g_critical("SMF error: unknown 0xFx-type status byte '0x%x'.", status);
+		return (-2);
 	}
 
-	/* Filter out the channel. */
-	status &= 0xF0;
+	g_critical("SMF error: unknown status byte '0x%x'.", status & 0xF0);
+	return (-3);
+}
 
-	switch (status) {
-		case 0x80: /* Note Off. */
-		case 0x90: /* Note On. */
-		case 0xA0: /* AfterTouch. */
-		case 0xB0: /* Control Change. */
-		case 0xE0: /* Pitch Wheel. */
-			return (3);	
+/*
+ * Location and shape of a single event in MTrk chunk, as found by decode_next_event().  MIDI message
+ * in normalized form, i.e. the way it is kept in #SmfEvent.midi_buffer, consists of "status" byte
+ * (unless it is -1, which is the case for escaped events) followed by "data_length" bytes at "data".
+ */
+struct decoded_event {
+	int			delta_time_pulses;
+	int			status;
+	const unsigned char	*data;
+	int			data_length;
 
-		case 0xC0: /* Program Change. */
-		case 0xD0: /* Channel Pressure. */
-			return (2);
+	/* Nonzero iff status byte immediately precedes "data", i.e. the message is stored contiguously. */
+	int			status_in_buffer;
 
-		default:
-			g_critical("SMF error: unknown status byte '0x%x'.", status);
-			return (-3);
-	}
+	/* Number of bytes the event takes in the chunk, including delta time. */
+	int			length;
+};
+
+/*
+ * Returns the byte that ends up in midi_buffer[0] of the decoded event; it becomes the new running status.
+ */
+static int
+decoded_first_byte(const struct decoded_event *decoded)
+{
+	if (decoded->status == -1)
+		return (decoded->data[0]);
+
+	return (decoded->status);
+}
+
+/*
+ * Returns 1 iff decoded event is End Of Track metaevent.
+ */
+static int
+decoded_is_end_of_track(const struct decoded_event *decoded)
+{
+	if (decoded->status == 0xFF && decoded->data_length >= 1 && decoded->data[0] == 0x2F)
+		return (1);
+
+	return (0);
 }
 
 static int
-extract_sysex_event(const unsigned char *buf, const int buffer_length, smf_event_t *event, int *len, int last_status)
+decode_sysex_event(const unsigned char *buf, const int buffer_length, struct decoded_event *decoded)
 {
 	int status, message_length, vlq_length;
 	const unsigned char *c = buf;
-	(void) last_status;
 
 	status = *buf;
 
@@ -407,31 +480,25 @@ extract_sysex_event(const unsigned char *buf, const int buffer_length, smf_event
 	c += vlq_length;
 
 	if (vlq_length + message_length >= buffer_length) {
-		g_critical("End of buffer in extract_sysex_event().");
+		g_critical("End of buffer in decode_sysex_event().");
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_sysex_event(): %s", strerror(errno));
-		return (-4);
-	}
-
-	event->midi_buffer[0] = status;
-	memcpy(event->midi_buffer + 1, c, message_length - 1);
-
-	*len = vlq_length + message_length;
+	decoded->status = status;
+	decoded->data = c;
+	decoded->data_length = message_length - 1;
+	decoded->status_in_buffer = 0;
+	decoded->length = vlq_length + message_length;
 
 	return (0);
 }
 
 static int
-extract_escaped_event(const unsigned char *buf, const int buffer_length, smf_event_t *event, int *len, int last_status)
+decode_escaped_event(const unsigned char *buf, const int buffer_length, struct decoded_event *decoded)
 {
 	int status, message_length, vlq_length;
 	const unsigned char *c = buf;
-	(void) last_status;
+	smf_event_t tmp;
 
 	status = *buf;
 
@@ -447,41 +514,40 @@ extract_escaped_event(const unsigned char *buf, const int buffer_length, smf_eve
 	c += vlq_length;
 
 	if (vlq_length + message_length >= buffer_length) {
-		g_critical("End of buffer in extract_escaped_event().");
+		g_critical("End of buffer in decode_escaped_event().");
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_escaped_event(): %s", strerror(errno));
-		return (-4);
-	}
+	/* The checks below need an event, but there is no need to allocate one. */
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.midi_buffer = (unsigned char *)c;
+	tmp.midi_buffer_length = message_length;
 
-	memcpy(event->midi_buffer, c, message_length);
-
-	if (smf_event_is_valid(event)) {
+	if (smf_event_is_valid(&tmp)) {
 		g_critical("Escaped event is invalid.");
 		return (-1);
 	}
 
-	if (smf_event_is_system_realtime(event) || smf_event_is_system_common(event)) {
+	if (smf_event_is_system_realtime(&tmp) || smf_event_is_system_common(&tmp)) {
 		g_warning("Escaped event is not System Realtime nor System Common.");
 	}
 
-	*len = vlq_length + message_length;
+	decoded->status = -1;
+	decoded->data = c;
+	decoded->data_length = message_length;
+	decoded->status_in_buffer = 0;
+	decoded->length = vlq_length + message_length;
 
 	return (0);
 }
 
-
 /*
- * Puts MIDI data extracted from from "buf" into "event" and number of consumed bytes into "len".
- * In case valid status is not found, it uses "last_status" (so called "running status").
+ * Locates MIDI message at "buf" and describes it in "decoded".  In case valid status is not found,
+ * it uses "last_status" (so called "running status").  Does not allocate anything.
  * Returns 0 iff everything went OK, value < 0 in case of error.
  */
 static int
-extract_midi_event(const unsigned char *buf, const int buffer_length, smf_event_t *event, int *len, int last_status)
+decode_midi_event(const unsigned char *buf, const int buffer_length, struct decoded_event *decoded, int last_status)
 {
 	int status, message_length;
 	const unsigned char *c = buf;
@@ -498,96 +564,197 @@ extract_midi_event(const unsigned char *buf, const int buffer_length, smf_event_
 		status = last_status;
 	}
 
-	if (!is_status_byte(status)) {
-		g_critical("SMF error: bad status byte (MSB is zero).");
-		return (-1);
-	}
+	message_length = message_lengths[status];
+
+	/* Anything but the messages of fixed length is less common, so check these all at once. */
+	if (message_length <= 0) {
+		if (message_length == MESSAGE_NOT_STATUS) {
+			g_critical("SMF error: bad status byte (MSB is zero).");
+			return (-1);
+		}
 
-	if (is_sysex_byte(status))
-		return (extract_sysex_event(buf, buffer_length, event, len, last_status));
+		if (message_length == MESSAGE_SYSEX)
+			return (decode_sysex_event(buf, buffer_length, decoded));
 
-	if (is_escape_byte(status))
-		return (extract_escaped_event(buf, buffer_length, event, len, last_status));
+		if (message_length == MESSAGE_ESCAPE)
+			return (decode_escaped_event(buf, buffer_length, decoded));
 
-	/* At this point, "c" points to first byte following the status byte. */
-	message_length = expected_message_length(status, c, buffer_length - (c - buf));
+		/* At this point, "c" points to first byte following the status byte. */
+		message_length = expected_message_length(status, c, buffer_length - (c - buf));
+	}
 
 	if (message_length < 0)
 		return (-3);
 
 	if (message_length - 1 > buffer_length - (c - buf)) {
-		g_critical("End of buffer in extract_midi_event().");
+		g_critical("End of buffer in decode_midi_event().");
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_midi_event(): %s", strerror(errno));
+	decoded->status = status;
+	decoded->data = c;
+	decoded->data_length = message_length - 1;
+	decoded->status_in_buffer = (c != buf);
+	decoded->length = c + message_length - 1 - buf;
+
+	return (0);
+}
+
+/*
+ * Decodes delta time and MIDI message of the event at "buf".  Returns 0 iff everything went OK.
+ */
+static int
+decode_next_event(const unsigned char *buf, const int buffer_length, struct decoded_event *decoded, int last_status)
+{
+	int len;
+
+	if (buffer_length <= 0) {
+		g_critical("End of buffer in decode_next_event().");
+		return (-1);
+	}
+
+	/* First, extract time offset from previous event. */
+	if (extract_vlq(buf, buffer_length, &decoded->delta_time_pulses, &len))
+		return (-2);
+
+	if (buffer_length - len <= 0)
+		return (-3);
+
+	/* Now, locate the actual event. */
+	if (decode_midi_event(buf + len, buffer_length - len, decoded, last_status))
 		return (-4);
+
+	decoded->length += len;
+
+	return (0);
+}
+
+/*
+ * Returns 1 iff the message described by "decoded" is stored in the file exactly the way we keep it,
+ * i.e. everything except running status messages and SysExes.
+ */
+static int
+decoded_is_contiguous(const struct decoded_event *decoded)
+{
+	return (decoded->status == -1 || decoded->status_in_buffer);
+}
+
+/*
+ * Returns length of the normalized MIDI message described by "decoded".
+ */
+static int
+decoded_message_length(const struct decoded_event *decoded)
+{
+	return (decoded->data_length + (decoded->status != -1));
+}
+
+/*
+ * Returns 1 iff extract_midi_event() is going to reference the message in place, in "mapped_file",
+ * instead of copying it.  Short messages are copied anyway; they fit into the event itself.
+ */
+static int
+decoded_is_borrowed(const struct decoded_event *decoded, GMappedFile *mapped_file)
+{
+	return (mapped_file != NULL && decoded_is_contiguous(decoded) &&
+		decoded_message_length(decoded) > SMF_EVENT_INLINE_BUFFER_SIZE);
+}
+
+/*
+ * Allocates an event for the message described by "decoded", taking it from "arena", unless it is NULL.
+ * Room for the MIDI data is allocated along with the event, unless extract_midi_event() is going to
+ * reference it in place in "mapped_file".
+ */
+static smf_event_t *
+new_decoded_event(const struct decoded_event *decoded, smf_arena_t *arena, GMappedFile *mapped_file)
+{
+	if (arena == NULL)
+		return (smf_event_new());
+
+	if (decoded_is_borrowed(decoded, mapped_file))
+		return (smf_event_new_from_arena(arena, 0));
+
+	return (smf_event_new_from_arena(arena, decoded_message_length(decoded)));
+}
+
+/*
+ * Fills event->midi_buffer with normalized MIDI message described by "decoded".  If the file is being
+ * loaded by smf_file_load_mmap(), "mapped_file" is its mapping and longer messages are referenced
+ * in place whenever possible; otherwise the message is copied, either into the room allocated along
+ * with the event by new_decoded_event(), or into newly allocated one.  Returns 0 iff everything went OK.
+ */
+static int
+extract_midi_event(const struct decoded_event *decoded, smf_event_t *event, GMappedFile *mapped_file)
+{
+	int length = decoded_message_length(decoded);
+	const unsigned char *data = decoded->status == -1 ? decoded->data : decoded->data - 1;
+
+	if (decoded_is_borrowed(decoded, mapped_file)) {
+		if (event->mapped_file == NULL)
+			event->mapped_file = g_mapped_file_ref(mapped_file);
+
+		event->midi_buffer = (unsigned char *)data;
+		event->midi_buffer_length = length;
+
+		return (0);
 	}
 
-	event->midi_buffer[0] = status;
-	memcpy(event->midi_buffer + 1, c, message_length - 1);
+	if (event->midi_buffer == NULL && smf_event_allocate_buffer(event, length))
+		return (-4);
+
+	assert(event->midi_buffer_length == length);
+
+	if (decoded_is_contiguous(decoded)) {
+		memcpy(event->midi_buffer, data, length);
+		return (0);
+	}
 
-	*len = c + message_length - 1 - buf;
+	event->midi_buffer[0] = decoded->status;
+	memcpy(event->midi_buffer + 1, decoded->data, decoded->data_length);
 
 	return (0);
 }
 
 /*
  * Locates, basing on track->next_event_offset, the next event data in track->buffer,
- * interprets it, allocates smf_event_t and fills it properly.  Returns smf_event_t
- * or NULL, if there was an error.  Allocating event means adding it to the track;
- * see smf_event_new().
+ * interprets it, allocates smf_event_t - from "arena", unless it is NULL - and fills it properly.
+ * Returns smf_event_t or NULL, if there was an error.  Event is appended to the track without
+ * any tempo map bookkeeping; see smf_track_append_parsed_event().
  */
 static smf_event_t *
-parse_next_event(smf_track_t *track)
+parse_next_event(smf_track_t *track, smf_arena_t *arena)
 {
-	int time = 0, len, buffer_length;
-	unsigned char *c, *start;
-
-	smf_event_t *event = smf_event_new();
-	if (event == NULL)
-		goto error;
+	int buffer_length;
+	unsigned char *start;
+	struct decoded_event decoded;
+	smf_event_t *event;
 
-	c = start = (unsigned char *)track->file_buffer + track->next_event_offset;
+	start = (unsigned char *)track->file_buffer + track->next_event_offset;
 
 	assert(track->file_buffer != NULL);
 	assert(track->file_buffer_length > 0);
 	assert(track->next_event_offset > 0);
 
+	/* May be zero if the track ends without EOT; decode_next_event() will fail then. */
 	buffer_length = track->file_buffer_length - track->next_event_offset;
-	assert(buffer_length > 0);
-
-	/* First, extract time offset from previous event. */
-	if (extract_vlq(c, buffer_length, &time, &len))
-		goto error;
 
-	c += len;
-	buffer_length -= len;
+	if (decode_next_event(start, buffer_length, &decoded, track->last_status))
+		return (NULL);
 
-	if (buffer_length <= 0)
-		goto error;
+	event = new_decoded_event(&decoded, arena, track->smf->mapped_file);
+	if (event == NULL)
+		return (NULL);
 
-	/* Now, extract the actual event. */
-	if (extract_midi_event(c, buffer_length, event, &len, track->last_status))
-		goto error;
+	if (extract_midi_event(&decoded, event, track->smf->mapped_file)) {
+		smf_event_delete(event);
+		return (NULL);
+	}
 
-	c += len;
-	buffer_length -= len;
 	track->last_status = event->midi_buffer[0];
-	track->next_event_offset += c - start;
+	track->next_event_offset += decoded.length;
 
-	smf_track_add_event_delta_pulses(track, event, time);
+	smf_track_append_parsed_event(track, event, decoded.delta_time_pulses);
 
 	return (event);
-
-error:
-	if (event != NULL)
-		smf_event_delete(event);
-
-	return (NULL);
 }
 
 /*
@@ -675,38 +842,6 @@ smf_event_extract_text(const smf_event_t *event)
 	return (make_string((void *)(&event->midi_buffer[2] + length_length), event->midi_buffer_length - 2 - length_length, string_length));
 }
 
-/*
- * Verify if the next chunk really is MTrk chunk, and if so, initialize some track variables and return 0.
- * Return different value otherwise.
- */
-static int
-parse_mtrk_header(smf_track_t *track)
-{
-	struct chunk_header_struct *mtrk;
-
-	/* Make sure compiler didn't do anything stupid. */
-	assert(sizeof(struct chunk_header_struct) == 8);
-	assert(track->smf != NULL);
-
-	mtrk = next_chunk(track->smf);
-
-	if (mtrk == NULL)
-		return (-1);
-
-	if (!chunk_signature_matches(mtrk, "MTrk")) {
-		g_warning("SMF warning: Expected MTrk signature, got %c%c%c%c instead; ignoring this chunk.",
-				mtrk->id[0], mtrk->id[1], mtrk->id[2], mtrk->id[3]);
-		
-		return (-2);
-	}
-
-	track->file_buffer = mtrk;
-	track->file_buffer_length = sizeof(struct chunk_header_struct) + ntohl(mtrk->length);
-	track->next_event_offset = sizeof(struct chunk_header_struct);
-
-	return (0);
-}
-
 /*
  * Return 1 if event is end-of-the-track, 0 otherwise.
  */
@@ -775,26 +910,29 @@ smf_event_is_valid(const smf_event_t *event)
 }
 
 /*
- * Parse events and put it on the track.
+ * Parse events from track->file_buffer and put them on the track, allocating them from "arena",
+ * if it is not NULL.  Tempo map is not updated, and ->time_seconds of the events is not computed;
+ * see smf_track_compute_seconds().
  */
 static int
-parse_mtrk_chunk(smf_track_t *track)
+parse_mtrk_events(smf_track_t *track, smf_arena_t *arena)
 {
 	smf_event_t *event;
 
-	if (parse_mtrk_header(track))
-		return (-1);
-
 	for (;;) {
-		event = parse_next_event(track);
+		event = parse_next_event(track, arena);
 
 		/* Couldn't parse an event? */
 		if (event == NULL) {
 			g_critical("Unable to parse MIDI event; truncating track.");
-			if (smf_track_add_eot_delta_pulses(track, 0) != 0) {
-				g_critical("smf_track_add_eot_delta_pulses failed.");
+
+			event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
+			if (event == NULL) {
+				g_critical("smf_event_new_from_bytes failed.");
 				return (-2);
 			}
+
+			smf_track_append_parsed_event(track, event, 0);
 			break;
 		}
 
@@ -812,116 +950,470 @@ parse_mtrk_chunk(smf_track_t *track)
 }
 
 /*
- * Allocate buffer of proper size and read file contents into it.  Close file afterwards.
+ * Summary of MTrk chunk contents, filled by scan_mtrk_chunk().
  */
-static int
-load_file_into_buffer(void **file_buffer, int *file_buffer_length, const char *file_name)
+struct mtrk_scan {
+	int	number_of_events;
+	int	first_event_pulses;
+	int	last_event_pulses;
+};
+
+/*
+ * Called by scan_mtrk_chunk() for every metaevent found, along with its time in pulses.
+ */
+typedef void (*scan_metaevent_func)(const struct decoded_event *decoded, int pulses, void *user_data);
+
+/*
+ * Walks the events of MTrk chunk "chunk" (chunk header included) the same way parse_mtrk_events()
+ * would, but without creating them, and fills "scan" with the summary.  If "func" is not NULL,
+ * it gets called for every metaevent.
+ */
+static void
+scan_mtrk_chunk(const unsigned char *chunk, const int chunk_length, struct mtrk_scan *scan,
+	scan_metaevent_func func, void *user_data)
 {
-	FILE *stream = fopen(file_name, "rb");
+	int offset = sizeof(struct chunk_header_struct), pulses = 0, last_status = 0;
+	struct decoded_event decoded;
 
-	if (stream == NULL) {
-		g_critical("Cannot open input file: %s", strerror(errno));
+	memset(scan, 0, sizeof(*scan));
 
-		return (-1);
-	}
+	for (;;) {
+		if (decode_next_event(chunk + offset, chunk_length - offset, &decoded, last_status)) {
+			/* This is where parse_mtrk_events() truncates the track, adding EOT. */
+			if (scan->number_of_events == 0)
+				scan->first_event_pulses = pulses;
 
-	if (fseek(stream, 0, SEEK_END)) {
-		g_critical("fseek(3) failed: %s", strerror(errno));
+			scan->number_of_events++;
+			scan->last_event_pulses = pulses;
 
-		return (-2);
-	}
+			return;
+		}
 
-	*file_buffer_length = ftell(stream);
-	if (*file_buffer_length == -1) {
-		g_critical("ftell(3) failed: %s", strerror(errno));
+		pulses += decoded.delta_time_pulses;
 
-		return (-3);
-	}
+		if (scan->number_of_events == 0)
+			scan->first_event_pulses = pulses;
 
-	if (fseek(stream, 0, SEEK_SET)) {
-		g_critical("fseek(3) failed: %s", strerror(errno));
+		scan->number_of_events++;
+		scan->last_event_pulses = pulses;
 
-		return (-4);
-	}
+		if (func != NULL && decoded.status == 0xFF)
+			func(&decoded, pulses, user_data);
 
-	*file_buffer = malloc(*file_buffer_length);
-	if (*file_buffer == NULL) {
-		g_critical("malloc(3) failed: %s", strerror(errno));
+		if (decoded_is_end_of_track(&decoded))
+			return;
 
-		return (-5);
+		last_status = decoded_first_byte(&decoded);
+		offset += decoded.length;
 	}
+}
 
-	if (fread(*file_buffer, 1, *file_buffer_length, stream) != *file_buffer_length) {
-		g_critical("fread(3) failed: %s", strerror(errno));
+/*
+ * Tempo related metaevent found by scan_mtrk_chunk() during smf_file_load_lazy().
+ */
+struct scanned_tempo {
+	int		time_pulses;
+	int		order;
+	int		midi_buffer_length;
+	unsigned char	midi_buffer[8];
+};
+
+static void
+collect_tempo(const struct decoded_event *decoded, int pulses, void *user_data)
+{
+	GArray *tempos = user_data;
+	struct scanned_tempo tempo;
 
-		return (-6);
-	}
-	
-	if (fclose(stream)) {
-		g_critical("fclose(3) failed: %s", strerror(errno));
+	if (decoded->data_length < 1 || (decoded->data[0] != 0x51 && decoded->data[0] != 0x58))
+		return;
 
-		return (-7);
-	}
+	memset(&tempo, 0, sizeof(tempo));
+	tempo.time_pulses = pulses;
+	tempo.order = tempos->len;
+	tempo.midi_buffer_length = MIN(decoded->data_length + 1, (int)sizeof(tempo.midi_buffer));
+	tempo.midi_buffer[0] = 0xFF;
+	memcpy(tempo.midi_buffer + 1, decoded->data, tempo.midi_buffer_length - 1);
 
-	return (0);
+	g_array_append_val(tempos, tempo);
 }
 
-/**
- * smf_file_load_from_memory:
- * @buffer: (array length=buffer_length) (element-type guint8) (transfer none):
- *   memory buffer containing an SMF file.
- * @buffer_length: length of @buffer
- *
- * Creates new SMF and fills it with data loaded from the given @buffer.
- *
- * Returns: (transfer full): SMF or NULL, if loading failed.
- *
- * Since: 1.4
+/*
+ * Used for sorting scanned tempos into the order smf_file_get_next_event() would return them.
  */
-smf_t *
-smf_file_load_from_memory(const void *buffer, const int buffer_length)
+static gint
+scanned_tempo_compare_function(gconstpointer aa, gconstpointer bb)
+{
+	const struct scanned_tempo *a = aa, *b = bb;
+
+	if (a->time_pulses != b->time_pulses)
+		return (a->time_pulses < b->time_pulses ? -1 : 1);
+
+	return (a->order < b->order ? -1 : (a->order > b->order));
+}
+
+/*
+ * Builds the tempo map of "smf" from tempo related metaevents collected by collect_tempo().
+ * Sorts them first, so that they end up in the same order as if the events were added one by one.
+ */
+static void
+add_scanned_tempos(smf_t *smf, GArray *tempos)
 {
 	int i;
 
-	smf_t *smf = smf_new();
+	g_array_sort(tempos, scanned_tempo_compare_function);
 
-	smf->file_buffer = (void *)buffer;
-	smf->file_buffer_length = buffer_length;
-	smf->next_chunk_offset = 0;
+	for (i = 0; i < tempos->len; i++) {
+		struct scanned_tempo *tempo = &g_array_index(tempos, struct scanned_tempo, i);
 
-	if (parse_mthd_chunk(smf))
-		return (NULL);
+		maybe_add_metaevent_to_tempo_map(smf, tempo->time_pulses, tempo->midi_buffer, tempo->midi_buffer_length);
+	}
+}
 
-	for (i = 1; i <= smf->expected_number_of_tracks; i++) {
-		smf_track_t *track = smf_track_new();
-		if (track == NULL)
-			return (NULL);
+/*
+ * Returns how much memory events of MTrk chunk "chunk_length" bytes long, containing "number_of_events"
+ * events, are going to take in the arena.  MIDI data takes at most as much as it takes in the chunk,
+ * plus status byte for running status messages - or nothing, if it gets referenced in place.
+ */
+static size_t
+arena_size_for_chunk(int chunk_length, int number_of_events, GMappedFile *mapped_file)
+{
+	size_t size = number_of_events * (sizeof(smf_event_t) + SMF_ARENA_ALIGNMENT);
 
-		smf_add_track(smf, track);
+	if (mapped_file == NULL)
+		size += chunk_length + number_of_events;
 
-		/* Skip unparseable chunks. */
-		if (parse_mtrk_chunk(track)) {
-			g_warning("SMF warning: Cannot load track.");
-			smf_track_delete(track);
-		}
+	return (size);
+}
 
-		track->file_buffer = NULL;
-		track->file_buffer_length = 0;
-		track->next_event_offset = -1;
+/*
+ * Work item of load_from_buffer(): a single MTrk chunk to parse.
+ */
+struct track_load_job {
+	smf_track_t	*track;
+	GArray		*tempos;
+	int		failed;
+};
+
+/*
+ * Parses events of the track and collects its tempo related metaevents into job->tempos.
+ * Nothing outside of the track is touched here, so any number of these may run at the same
+ * time.  Chunk gets scanned first, so that events_array and the arena can be allocated at their
+ * final size instead of growing them event by event.  "user_data" is GCancellable or NULL;
+ * once it gets cancelled, remaining tracks are not parsed.
+ */
+static void
+parse_track_job(gpointer data, gpointer user_data)
+{
+	struct track_load_job *job = data;
+	struct mtrk_scan scan;
+	smf_arena_t *arena;
+	smf_track_t *track = job->track;
+	GCancellable *cancellable = user_data;
+
+	if (g_cancellable_is_cancelled(cancellable)) {
+		job->failed = 1;
+		return;
 	}
 
-	if (smf->expected_number_of_tracks != smf->number_of_tracks) {
-		g_warning("SMF warning: MThd header declared %d tracks, but only %d found; continuing anyway.",
-				smf->expected_number_of_tracks, smf->number_of_tracks);
+	scan_mtrk_chunk(track->file_buffer, track->file_buffer_length, &scan, collect_tempo, job->tempos);
 
-		smf->expected_number_of_tracks = smf->number_of_tracks;
+	smf_track_reserve_events(track, scan.number_of_events);
+
+	arena = smf_arena_new(arena_size_for_chunk(track->file_buffer_length, scan.number_of_events,
+		track->smf->mapped_file));
+	if (arena == NULL) {
+		job->failed = 1;
+		return;
 	}
 
-	smf->file_buffer = NULL;
+	if (parse_mtrk_events(track, arena))
+		job->failed = 1;
+
+	/* From now on, the arena lives as long as any of the events. */
+	smf_arena_unref(arena);
+}
+
+/*
+ * Used for sorting jobs so that the longest tracks get parsed first.
+ */
+static int
+job_compare_function(const void *aa, const void *bb)
+{
+	const struct track_load_job *a = *(struct track_load_job * const *)aa, *b = *(struct track_load_job * const *)bb;
+
+	if (a->track->file_buffer_length != b->track->file_buffer_length)
+		return (a->track->file_buffer_length > b->track->file_buffer_length ? -1 : 1);
+
+	return (a->track->track_number - b->track->track_number);
+}
+
+/*
+ * Parses the jobs using up to "max_threads" threads.  Falls back to doing it
+ * in the calling thread if the thread pool cannot be created.
+ */
+static void
+run_track_load_jobs(struct track_load_job *jobs, int number_of_jobs, int max_threads, GCancellable *cancellable)
+{
+	int i;
+	GThreadPool *pool = NULL;
+	GError *error = NULL;
+	struct track_load_job **queue;
+
+	if (max_threads <= 0)
+		max_threads = g_get_num_processors();
+
+	if (max_threads > number_of_jobs)
+		max_threads = number_of_jobs;
+
+	if (max_threads > 1) {
+		pool = g_thread_pool_new(parse_track_job, cancellable, max_threads, FALSE, &error);
+		if (pool == NULL) {
+			g_warning("SMF warning: Cannot create thread pool, loading in single thread: %s", error->message);
+			g_error_free(error);
+		}
+	}
+
+	if (pool == NULL) {
+		for (i = 0; i < number_of_jobs; i++)
+			parse_track_job(&jobs[i], cancellable);
+
+		return;
+	}
+
+	/* Dense tracks go first, so that one of them does not end up being parsed alone at the end. */
+	queue = malloc(number_of_jobs * sizeof(*queue));
+	if (queue != NULL) {
+		for (i = 0; i < number_of_jobs; i++)
+			queue[i] = &jobs[i];
+
+		qsort(queue, number_of_jobs, sizeof(*queue), job_compare_function);
+	}
+
+	for (i = 0; i < number_of_jobs; i++) {
+		struct track_load_job *job = queue != NULL ? queue[i] : &jobs[i];
+
+		if (!g_thread_pool_push(pool, job, &error)) {
+			g_warning("SMF warning: Cannot start thread, loading track in calling thread: %s", error->message);
+			g_error_free(error);
+			error = NULL;
+
+			parse_track_job(job, cancellable);
+		}
+	}
+
+	/* Waits for all the jobs to finish. */
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	free(queue);
+}
+
+/*
+ * Creates new SMF and fills it with data parsed from "buffer".  If "mapped_file" is not NULL,
+ * "buffer" is its contents and the events will reference it instead of copying MIDI data.
+ *
+ * Chunks are located first; then every track is parsed independently, without touching the tempo
+ * map - using up to "max_threads" threads.  Afterwards, the tempo map is built from the metaevents
+ * collected from all the tracks, and ->time_seconds of the events is computed, one pass per track.
+ * Adding parsed events one by one using smf_track_add_event() instead would rebuild the whole tempo
+ * map for every tempo change that is not the last event of the song so far, which is the case for
+ * all of them when tempo track is not the first one.
+ *
+ * If "cancellable" gets cancelled, tracks not parsed yet are skipped and NULL is returned.
+ */
+static smf_t *
+load_from_buffer(const void *buffer, const int buffer_length, GMappedFile *mapped_file, int max_threads,
+	GCancellable *cancellable)
+{
+	int i, j, number_of_jobs = 0, chunk_offset;
+	struct chunk_header_struct *mtrk;
+	struct track_load_job *jobs;
+	GArray *tempos;
+	smf_track_t *track;
+
+	smf_t *smf = smf_new();
+
+	if (mapped_file != NULL)
+		smf->mapped_file = g_mapped_file_ref(mapped_file);
+
+	smf->file_buffer = (void *)buffer;
+	smf->file_buffer_length = buffer_length;
+	smf->next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(smf)) {
+		smf_file_unref(smf);
+		return (NULL);
+	}
+
+	jobs = malloc(smf->expected_number_of_tracks * sizeof(*jobs));
+	if (jobs == NULL) {
+		g_critical("Cannot allocate memory in load_from_buffer(): %s", strerror(errno));
+		smf_file_unref(smf);
+		return (NULL);
+	}
+
+	for (i = 1; i <= smf->expected_number_of_tracks; i++) {
+		mtrk = next_chunk(smf);
+
+		/* Skip unparseable chunks. */
+		if (mtrk == NULL || !chunk_signature_matches(mtrk, "MTrk")) {
+			if (mtrk != NULL)
+				g_warning("SMF warning: Expected MTrk signature, got %c%c%c%c instead; ignoring this chunk.",
+					mtrk->id[0], mtrk->id[1], mtrk->id[2], mtrk->id[3]);
+
+			g_warning("SMF warning: Cannot load track.");
+			continue;
+		}
+
+		track = smf_track_new();
+		if (track == NULL)
+			goto error;
+
+		smf_add_track(smf, track);
+
+		chunk_offset = (unsigned char *)mtrk - (unsigned char *)buffer;
+		track->file_buffer = mtrk;
+		track->file_buffer_length = MIN(sizeof(struct chunk_header_struct) + ntohl(mtrk->length),
+			buffer_length - chunk_offset);
+		track->next_event_offset = sizeof(struct chunk_header_struct);
+
+		jobs[number_of_jobs].track = track;
+		jobs[number_of_jobs].tempos = g_array_new(FALSE, FALSE, sizeof(struct scanned_tempo));
+		jobs[number_of_jobs].failed = 0;
+		number_of_jobs++;
+	}
+
+	run_track_load_jobs(jobs, number_of_jobs, max_threads, cancellable);
+
+	if (g_cancellable_is_cancelled(cancellable))
+		goto error;
+
+	/* Merge step.  Order of tempos has to be the same as if the tracks were parsed one after another. */
+	tempos = g_array_new(FALSE, FALSE, sizeof(struct scanned_tempo));
+
+	for (i = 0; i < number_of_jobs; i++) {
+		if (jobs[i].failed) {
+			g_warning("SMF warning: Cannot load track.");
+			smf_track_delete(jobs[i].track);
+			continue;
+		}
+
+		for (j = 0; j < jobs[i].tempos->len; j++) {
+			struct scanned_tempo *tempo = &g_array_index(jobs[i].tempos, struct scanned_tempo, j);
+
+			tempo->order = tempos->len;
+			g_array_append_val(tempos, *tempo);
+		}
+	}
+
+	add_scanned_tempos(smf, tempos);
+	g_array_free(tempos, TRUE);
+
+	for (i = 0; i < smf->tracks_array->len; i++)
+		smf_track_compute_seconds(g_ptr_array_index(smf->tracks_array, i));
+
+	/* Tracks got filled in without keeping the cached length up to date. */
+	smf->length_valid = 0;
+
+	if (smf->expected_number_of_tracks != smf->number_of_tracks) {
+		g_warning("SMF warning: MThd header declared %d tracks, but only %d found; continuing anyway.",
+				smf->expected_number_of_tracks, smf->number_of_tracks);
+
+		smf->expected_number_of_tracks = smf->number_of_tracks;
+	}
+
+	for (i = 0; i < number_of_jobs; i++)
+		g_array_free(jobs[i].tempos, TRUE);
+	free(jobs);
+
+	smf->file_buffer = NULL;
 	smf->file_buffer_length = 0;
 	smf->next_chunk_offset = -1;
 
+	smf_file_rewind(smf);
+
 	return (smf);
+
+error:
+	for (i = 0; i < number_of_jobs; i++)
+		g_array_free(jobs[i].tempos, TRUE);
+	free(jobs);
+
+	smf_file_unref(smf);
+
+	return (NULL);
+}
+
+/*
+ * Allocate buffer of proper size and read file contents into it.  Close file afterwards.
+ */
+static int
+load_file_into_buffer(void **file_buffer, int *file_buffer_length, const char *file_name)
+{
+	FILE *stream = fopen(file_name, "rb");
+
+	if (stream == NULL) {
+		g_critical("Cannot open input file: %s", strerror(errno));
+
+		return (-1);
+	}
+
+	if (fseek(stream, 0, SEEK_END)) {
+		g_critical("fseek(3) failed: %s", strerror(errno));
+
+		return (-2);
+	}
+
+	*file_buffer_length = ftell(stream);
+	if (*file_buffer_length == -1) {
+		g_critical("ftell(3) failed: %s", strerror(errno));
+
+		return (-3);
+	}
+
+	if (fseek(stream, 0, SEEK_SET)) {
+		g_critical("fseek(3) failed: %s", strerror(errno));
+
+		return (-4);
+	}
+
+	*file_buffer = malloc(*file_buffer_length);
+	if (*file_buffer == NULL) {
+		g_critical("malloc(3) failed: %s", strerror(errno));
+
+		return (-5);
+	}
+
+	if (fread(*file_buffer, 1, *file_buffer_length, stream) != *file_buffer_length) {
+		g_critical("fread(3) failed: %s", strerror(errno));
+
+		return (-6);
+	}
+	
+	if (fclose(stream)) {
+		g_critical("fclose(3) failed: %s", strerror(errno));
+
+		return (-7);
+	}
+
+	return (0);
+}
+
+/**
+ * smf_file_load_from_memory:
+ * @buffer: (array length=buffer_length) (element-type guint8) (transfer none):
+ *   memory buffer containing an SMF file.
+ * @buffer_length: length of @buffer
+ *
+ * Creates new SMF and fills it with data loaded from the given @buffer.
+ *
+ * Returns: (transfer full): SMF or NULL, if loading failed.
+ *
+ * Since: 1.4
+ */
+smf_t *
+smf_file_load_from_memory(const void *buffer, const int buffer_length)
+{
+	return (load_from_buffer(buffer, buffer_length, NULL, 1, NULL));
 }
 
 /**
@@ -957,3 +1449,1728 @@ smf_file_load(const char *file_name)
 	return (smf);
 }
 
+/*
+ * Maps the file privately for smf_file_load_mmap() and smf_file_load_lazy().  Returns NULL in case of error.
+ */
+static GMappedFile *
+map_file(const char *file_name)
+{
+	int fd;
+	GMappedFile *mapped_file;
+	GError *error = NULL;
+
+	fd = open(file_name, O_RDONLY | O_BINARY);
+	if (fd == -1) {
+		g_critical("Cannot open input file: %s", strerror(errno));
+
+		return (NULL);
+	}
+
+	/* Writable, so that events can be edited in place; the mapping is private, it never gets written back. */
+	mapped_file = g_mapped_file_new_from_fd(fd, TRUE, &error);
+	close(fd);
+
+	if (mapped_file == NULL) {
+		g_critical("Cannot map input file: %s", error->message);
+		g_error_free(error);
+
+		return (NULL);
+	}
+
+	if (g_mapped_file_get_contents(mapped_file) == NULL) {
+		g_critical("SMF error: file is empty, it cannot be a MIDI file.");
+		g_mapped_file_unref(mapped_file);
+
+		return (NULL);
+	}
+
+	return (mapped_file);
+}
+
+/**
+ * smf_file_load_mmap:
+ * @file_name: Path to the file.
+ *
+ * Loads SMF file, just like smf_file_load(), but instead of reading the file into memory
+ * and copying MIDI data of every event out of it, maps the file and makes events point
+ * directly into the mapping whenever their MIDI data is stored in the file in the same form
+ * libsmf keeps it (that is, everything except SysExes and running status messages).  Messages
+ * short enough to be stored within the event itself, which is most of them, get copied anyway.
+ * The mapping is private, so #SmfEvent.midi_buffer may still be modified in place; pages
+ * get copied as they are written to, and the file itself is never changed.  The mapping
+ * lives as long as the SMF or any of its events.
+ *
+ * Note that #SmfEvent.midi_buffer of such events is not allocated with malloc(3), so do not
+ * free(3) it.  Replacing it with malloc(3)ed buffer of your own is fine, libsmf will free that one.
+ *
+ * Returns: (transfer full): SMF or NULL, if loading failed.
+ *
+ * Since: 1.4
+ */
+smf_t *
+smf_file_load_mmap(const char *file_name)
+{
+	GMappedFile *mapped_file;
+	smf_t *smf;
+
+	mapped_file = map_file(file_name);
+	if (mapped_file == NULL)
+		return (NULL);
+
+	smf = load_from_buffer(g_mapped_file_get_contents(mapped_file), g_mapped_file_get_length(mapped_file), mapped_file, 1, NULL);
+
+	/* From now on, the SMF and its events hold references to the mapping. */
+	g_mapped_file_unref(mapped_file);
+
+	if (smf == NULL)
+		return (NULL);
+
+	smf_file_rewind(smf);
+
+	return (smf);
+}
+
+/**
+ * smf_file_load_lazy:
+ * @file_name: Path to the file.
+ *
+ * Loads SMF file, just like smf_file_load_mmap(), but does not parse the events until they are needed.
+ * Loading only walks the tracks to find out their number of events, length and tempo map.  Events of
+ * the track get parsed the first time it is accessed using smf_file_get_track_by_number(),
+ * smf_track_get_event_by_number(), smf_track_get_next_event() or by iterating over the whole song.
+ * Everything else works as usual, except that you should not access #SmfTrack.events_array directly
+ * until events of the track are parsed.  See also smf_file_evict_untouched_tracks().
+ *
+ * Returns: (transfer full): SMF or NULL, if loading failed.
+ *
+ * Since: 1.4
+ */
+smf_t *
+smf_file_load_lazy(const char *file_name)
+{
+	int i, chunk_offset;
+	unsigned char *contents;
+	struct chunk_header_struct *mtrk;
+	struct mtrk_scan scan;
+	GArray *tempos;
+	smf_track_t *track;
+	smf_t *smf;
+
+	smf = smf_file_new();
+
+	smf->mapped_file = map_file(file_name);
+	if (smf->mapped_file == NULL) {
+		smf_file_unref(smf);
+		return (NULL);
+	}
+
+	contents = (unsigned char *)g_mapped_file_get_contents(smf->mapped_file);
+
+	smf->file_buffer = contents;
+	smf->file_buffer_length = g_mapped_file_get_length(smf->mapped_file);
+	smf->next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(smf)) {
+		smf_file_unref(smf);
+		return (NULL);
+	}
+
+	tempos = g_array_new(FALSE, FALSE, sizeof(struct scanned_tempo));
+
+	for (i = 1; i <= smf->expected_number_of_tracks; i++) {
+		mtrk = next_chunk(smf);
+
+		/* Skip unparseable chunks. */
+		if (mtrk == NULL || !chunk_signature_matches(mtrk, "MTrk")) {
+			if (mtrk != NULL)
+				g_warning("SMF warning: Expected MTrk signature, got %c%c%c%c instead; ignoring this chunk.",
+					mtrk->id[0], mtrk->id[1], mtrk->id[2], mtrk->id[3]);
+
+			g_warning("SMF warning: Cannot load track.");
+			continue;
+		}
+
+		track = smf_track_new();
+		if (track == NULL) {
+			g_array_free(tempos, TRUE);
+			smf_file_unref(smf);
+			return (NULL);
+		}
+
+		smf_file_add_track(smf, track);
+
+		chunk_offset = (unsigned char *)mtrk - contents;
+		track->chunk_offset = chunk_offset;
+		track->chunk_length = MIN(sizeof(struct chunk_header_struct) + ntohl(mtrk->length),
+			smf->file_buffer_length - chunk_offset);
+
+		scan_mtrk_chunk(contents + chunk_offset, track->chunk_length, &scan, collect_tempo, tempos);
+
+		track->number_of_events = scan.number_of_events;
+		track->chunk_length_pulses = scan.last_event_pulses;
+		track->events_pending = 1;
+
+		/* Rewound, just like smf_file_load() leaves it. */
+		track->next_event_number = 1;
+		track->time_of_next_event = scan.first_event_pulses;
+		smf_track_position_changed(track);
+	}
+
+	if (smf->expected_number_of_tracks != smf->number_of_tracks) {
+		g_warning("SMF warning: MThd header declared %d tracks, but only %d found; continuing anyway.",
+				smf->expected_number_of_tracks, smf->number_of_tracks);
+
+		smf->expected_number_of_tracks = smf->number_of_tracks;
+	}
+
+	/* Tempo map has to be complete before any track gets parsed, as it is needed to compute ->time_seconds. */
+	add_scanned_tempos(smf, tempos);
+	g_array_free(tempos, TRUE);
+
+	/* Tracks got their ->number_of_events without keeping the cached length up to date. */
+	smf->length_valid = 0;
+
+	smf->file_buffer = NULL;
+	smf->file_buffer_length = 0;
+	smf->next_chunk_offset = -1;
+
+	return (smf);
+}
+
+/*
+ * Internal:
+ *
+ * Parses events of the track loaded by smf_file_load_lazy(), either for the first time,
+ * or after smf_file_evict_untouched_tracks() dropped them.  Tempo map is complete at this
+ * point, so parsed events are simply appended, without going through tempo map bookkeeping.
+ */
+void
+smf_track_load_pending_events(smf_track_t *track)
+{
+	int next_event_number, time_of_next_event, number_of_events;
+	smf_arena_t *arena;
+	smf_t *smf = track->smf;
+
+	assert(track->events_pending);
+	assert(smf != NULL);
+	assert(smf->mapped_file != NULL);
+	assert(track->events_array->len == 0);
+
+	/* Keep position of the track, as if the events never went away. */
+	next_event_number = track->next_event_number;
+	time_of_next_event = track->time_of_next_event;
+	number_of_events = track->number_of_events;
+
+	/* Number of events is known from the scan done while loading. */
+	smf_track_reserve_events(track, track->number_of_events);
+
+	/* Separate arena for every track, so that evicting it frees the memory. */
+	arena = smf_arena_new(arena_size_for_chunk(track->chunk_length, track->number_of_events, smf->mapped_file));
+
+	track->events_pending = 0;
+	track->number_of_events = 0;
+	track->next_event_number = -1;
+	track->last_status = 0;
+
+	track->file_buffer = (unsigned char *)g_mapped_file_get_contents(smf->mapped_file) + track->chunk_offset;
+	track->file_buffer_length = track->chunk_length;
+	track->next_event_offset = sizeof(struct chunk_header_struct);
+
+	if (arena == NULL || parse_mtrk_events(track, arena))
+		g_critical("SMF warning: Cannot load events of track %d.", track->track_number);
+
+	if (arena != NULL)
+		smf_arena_unref(arena);
+
+	track->file_buffer = NULL;
+	track->file_buffer_length = 0;
+	track->next_event_offset = -1;
+
+	smf_track_compute_seconds(track);
+
+	/* Normally the same as found by the scan, unless parsing failed. */
+	smf_file_track_length_changed(smf, track->chunk_length_pulses, smf_track_length_pulses(track));
+	if (track->number_of_events != number_of_events)
+		smf_track_events_changed(track);
+
+	if (next_event_number > track->number_of_events) {
+		next_event_number = -1;
+		smf_track_position_changed(track);
+	}
+
+	track->next_event_number = next_event_number;
+	track->time_of_next_event = time_of_next_event;
+}
+
+/*
+ * Returns 1 iff any event of the track is referenced from outside of the track.
+ */
+static int
+track_events_are_referenced(const smf_track_t *track)
+{
+	int i;
+
+	for (i = 0; i < track->events_array->len; i++) {
+		smf_event_t *event = g_ptr_array_index(track->events_array, i);
+
+		if (event != NULL && g_atomic_int_get(&event->ref_count) > 1)
+			return (1);
+	}
+
+	return (0);
+}
+
+/**
+ * smf_file_evict_untouched_tracks:
+ * @smf: SMF loaded using smf_file_load_lazy().
+ *
+ * Frees parsed events of the tracks that were not accessed since the previous call to this function
+ * (or since loading), so that they will get parsed again from the file when needed.  Tracks that
+ * were modified or compacted, or have events referenced from elsewhere, are left alone.  Call this periodically,
+ * or when memory gets tight, to keep only the tracks that are actually in use in memory.
+ *
+ * Returns: Number of tracks evicted.
+ *
+ * Since: 1.4
+ */
+int
+smf_file_evict_untouched_tracks(smf_t *smf)
+{
+	int i, evicted = 0;
+	smf_track_t *track;
+
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i);
+
+		if (track->chunk_length > 0 && !track->events_pending && !track->events_touched &&
+		    !track->events_modified && track->columns == NULL && !track_events_are_referenced(track)) {
+			g_ptr_array_set_size(track->events_array, 0);
+			track->events_pending = 1;
+			evicted++;
+		}
+
+		track->events_touched = 0;
+	}
+
+	return (evicted);
+}
+
+/*
+ * State of smf_file_probe() while scanning a single track.
+ */
+struct track_probe {
+	GArray	*tempos;
+	char	*track_name;
+};
+
+/*
+ * Called by scan_mtrk_chunk() during smf_file_probe().  Collects tempo related metaevents and
+ * the first Sequence/Track Name metaevent, without creating any events.
+ */
+static void
+probe_metaevent(const struct decoded_event *decoded, int pulses, void *user_data)
+{
+	int length, vlq_length;
+	struct track_probe *track_probe = user_data;
+
+	collect_tempo(decoded, pulses, track_probe->tempos);
+
+	/* data[0] is the metaevent type, followed by VLQ length and the text itself. */
+	if (track_probe->track_name != NULL || decoded->data_length < 3 || decoded->data[0] != 0x03)
+		return;
+
+	if (extract_vlq(decoded->data + 1, decoded->data_length - 1, &length, &vlq_length))
+		return;
+
+	if (length <= 0 || decoded->data_length - 1 - vlq_length <= 0)
+		return;
+
+	track_probe->track_name = make_string(decoded->data + 1 + vlq_length, decoded->data_length - 1 - vlq_length, length);
+}
+
+/**
+ * smf_file_probe:
+ * @file_name: Path to the file.
+ *
+ * Reads basic information about SMF file - format, timing, number of tracks, their names
+ * and length of the song - without loading it.  Tracks are walked just enough to find out
+ * their length and tempo map; no events are created, so this is much faster than
+ * smf_file_load() and uses very little memory, no matter how large the file is.
+ *
+ * Returns: (transfer full): Information about the file or %NULL, if it is not a valid SMF.
+ *
+ * Since: 1.4
+ */
+SmfProbe *
+smf_file_probe(const char *file_name)
+{
+	int i, chunk_offset, chunk_length;
+	unsigned char *contents;
+	struct chunk_header_struct *mtrk;
+	struct mtrk_scan scan;
+	struct track_probe track_probe;
+	GMappedFile *mapped_file;
+	SmfProbe *probe;
+	smf_t *smf;
+
+	mapped_file = map_file(file_name);
+	if (mapped_file == NULL)
+		return (NULL);
+
+	contents = (unsigned char *)g_mapped_file_get_contents(mapped_file);
+
+	/* Used for parsing MThd and building the tempo map; it never gets any tracks. */
+	smf = smf_file_new();
+	smf->file_buffer = contents;
+	smf->file_buffer_length = g_mapped_file_get_length(mapped_file);
+	smf->next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(smf)) {
+		smf->file_buffer = NULL;
+		smf_file_unref(smf);
+		g_mapped_file_unref(mapped_file);
+
+		return (NULL);
+	}
+
+	probe = malloc(sizeof(SmfProbe));
+	if (probe == NULL) {
+		g_critical("Cannot allocate SmfProbe structure: %s", strerror(errno));
+		goto error;
+	}
+
+	memset(probe, 0, sizeof(SmfProbe));
+	probe->ref_count = 1;
+	probe->format = smf->format;
+	probe->ppqn = smf->ppqn;
+	probe->frames_per_second = smf->frames_per_second;
+	probe->resolution = smf->resolution;
+
+	probe->track_names = calloc(smf->expected_number_of_tracks + 1, sizeof(char *));
+	if (probe->track_names == NULL) {
+		g_critical("Cannot allocate memory in smf_file_probe(): %s", strerror(errno));
+		goto error;
+	}
+
+	track_probe.tempos = g_array_new(FALSE, FALSE, sizeof(struct scanned_tempo));
+
+	for (i = 1; i <= smf->expected_number_of_tracks; i++) {
+		mtrk = next_chunk(smf);
+
+		/* Skip unparseable chunks, just like smf_file_load() does. */
+		if (mtrk == NULL || !chunk_signature_matches(mtrk, "MTrk"))
+			continue;
+
+		chunk_offset = (unsigned char *)mtrk - contents;
+		chunk_length = MIN(sizeof(struct chunk_header_struct) + ntohl(mtrk->length),
+			smf->file_buffer_length - chunk_offset);
+
+		track_probe.track_name = NULL;
+
+		scan_mtrk_chunk(contents + chunk_offset, chunk_length, &scan, probe_metaevent, &track_probe);
+
+		if (scan.last_event_pulses > probe->length_pulses)
+			probe->length_pulses = scan.last_event_pulses;
+
+		if (track_probe.track_name == NULL)
+			track_probe.track_name = strdup("");
+
+		probe->track_names[probe->number_of_tracks++] = track_probe.track_name;
+	}
+
+	add_scanned_tempos(smf, track_probe.tempos);
+	g_array_free(track_probe.tempos, TRUE);
+
+	probe->length_seconds = seconds_from_pulses(smf, probe->length_pulses);
+
+	smf->file_buffer = NULL;
+	smf_file_unref(smf);
+	g_mapped_file_unref(mapped_file);
+
+	return (probe);
+
+error:
+	if (probe != NULL)
+		smf_probe_unref(probe);
+
+	smf->file_buffer = NULL;
+	smf_file_unref(smf);
+	g_mapped_file_unref(mapped_file);
+
+	return (NULL);
+}
+
+/**
+ * smf_probe_ref:
+ * @probe: the probe
+ *
+ * Returns: (transfer full): @probe, with reference count increased by one.
+ *
+ * Since: 1.4
+ */
+SmfProbe *
+smf_probe_ref(SmfProbe *probe)
+{
+	g_atomic_int_inc(&probe->ref_count);
+	return (probe);
+}
+
+/**
+ * smf_probe_unref:
+ * @probe: (transfer full): the probe
+ *
+ * Decreases reference count of the probe, freeing it when it drops to zero.
+ *
+ * Since: 1.4
+ */
+void
+smf_probe_unref(SmfProbe *probe)
+{
+	char **name;
+
+	if (!g_atomic_int_dec_and_test(&probe->ref_count))
+		return;
+
+	if (probe->track_names != NULL) {
+		for (name = probe->track_names; *name != NULL; name++)
+			free(*name);
+
+		free(probe->track_names);
+	}
+
+	memset(probe, 0, sizeof(SmfProbe));
+	free(probe);
+}
+
+/**
+ * smf_file_load_from_memory_parallel:
+ * @buffer: (array length=buffer_length) (element-type guint8) (transfer none):
+ *   memory buffer containing an SMF file.
+ * @buffer_length: length of @buffer
+ * @max_threads: maximum number of threads to use, or 0 to use one per CPU.
+ *
+ * Same as smf_file_load_from_memory(), but parses the tracks in parallel.  Worth it
+ * for files with many large tracks; for format 0 files it makes no difference.
+ *
+ * Returns: (transfer full): SMF or NULL, if loading failed.
+ *
+ * Since: 1.4
+ */
+smf_t *
+smf_file_load_from_memory_parallel(const void *buffer, const int buffer_length, int max_threads)
+{
+	return (load_from_buffer(buffer, buffer_length, NULL, max_threads, NULL));
+}
+
+/**
+ * smf_file_load_parallel:
+ * @file_name: Path to the file.
+ * @max_threads: maximum number of threads to use, or 0 to use one per CPU.
+ *
+ * Same as smf_file_load(), but parses the tracks in parallel.  See smf_file_load_from_memory_parallel().
+ *
+ * Returns: (transfer full): SMF or NULL, if loading failed.
+ *
+ * Since: 1.4
+ */
+smf_t *
+smf_file_load_parallel(const char *file_name, int max_threads)
+{
+	int file_buffer_length;
+	void *file_buffer;
+	smf_t *smf;
+
+	if (load_file_into_buffer(&file_buffer, &file_buffer_length, file_name))
+		return (NULL);
+
+	smf = load_from_buffer(file_buffer, file_buffer_length, NULL, max_threads, NULL);
+
+	memset(file_buffer, 0, file_buffer_length);
+	free(file_buffer);
+
+	return (smf);
+}
+
+static void
+load_in_thread(GTask *task, G_GNUC_UNUSED gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	int file_buffer_length;
+	void *file_buffer;
+	smf_t *smf;
+	const char *file_name = task_data;
+
+	if (load_file_into_buffer(&file_buffer, &file_buffer_length, file_name)) {
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Cannot read file '%s'", file_name);
+		return;
+	}
+
+	smf = load_from_buffer(file_buffer, file_buffer_length, NULL, 1, cancellable);
+
+	memset(file_buffer, 0, file_buffer_length);
+	free(file_buffer);
+
+	if (smf != NULL) {
+		g_task_return_pointer(task, smf, (GDestroyNotify)smf_file_unref);
+		return;
+	}
+
+	if (!g_task_return_error_if_cancelled(task))
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Cannot load '%s'", file_name);
+}
+
+/**
+ * smf_file_load_async:
+ * @file_name: Path to the file.
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the file is loaded.
+ * @user_data: (closure): the data to pass to @callback.
+ *
+ * Loads SMF file in a worker thread, like smf_file_load().  When done, @callback is called
+ * in the thread-default main context of the caller; call smf_file_load_finish() from it
+ * to get the result.  Cancelling @cancellable stops loading before the next track.
+ *
+ * Since: 1.4
+ */
+void
+smf_file_load_async(const char *file_name, GCancellable *cancellable, GAsyncReadyCallback callback,
+	gpointer user_data)
+{
+	GTask *task;
+
+	task = g_task_new(NULL, cancellable, callback, user_data);
+	g_task_set_source_tag(task, smf_file_load_async);
+	g_task_set_task_data(task, g_strdup(file_name), g_free);
+
+	g_task_run_in_thread(task, load_in_thread);
+	g_object_unref(task);
+}
+
+/**
+ * smf_file_load_finish:
+ * @result: a #GAsyncResult passed to the callback of smf_file_load_async().
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Finishes loading started with smf_file_load_async().
+ *
+ * Returns: (transfer full): SMF or %NULL, if loading failed or was cancelled; @error is set then.
+ *
+ * Since: 1.4
+ */
+smf_t *
+smf_file_load_finish(GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+	g_return_val_if_fail(g_async_result_is_tagged(result, smf_file_load_async), NULL);
+
+	return (g_task_propagate_pointer(G_TASK(result), error));
+}
+
+/*
+ * Read buffer of smf_file_load_many_from_func().  There is one per worker - or, when reading with
+ * io_uring, one per file in flight; it only ever grows, so after the first few files, reading
+ * a file does not allocate anything.
+ */
+struct load_many_buffer {
+	void	*data;
+	int	length;
+	int	allocated;
+};
+
+/*
+ * Single file loaded by smf_file_load_many_from_func().
+ */
+struct load_many_job {
+	char			*file_name;
+	smf_t			*smf;
+	GError			*error;
+
+	/* Set if the file was already read, using io_uring. */
+	struct load_many_buffer	*buffer;
+	int			is_read;
+
+#ifdef HAVE_LIBURING
+	int			fd;
+	struct statx		statx;
+#endif
+};
+
+struct load_many {
+	GAsyncQueue	*buffers;
+	GAsyncQueue	*finished_jobs;
+};
+
+/*
+ * Like load_file_into_buffer(), but reuses the memory of "buffer".
+ */
+static int
+read_file_into_load_many_buffer(struct load_many_buffer *buffer, const char *file_name)
+{
+	long length;
+	void *data;
+	FILE *stream = fopen(file_name, "rb");
+
+	if (stream == NULL) {
+		g_critical("Cannot open input file: %s", strerror(errno));
+
+		return (-1);
+	}
+
+	if (fseek(stream, 0, SEEK_END)) {
+		g_critical("fseek(3) failed: %s", strerror(errno));
+		fclose(stream);
+
+		return (-2);
+	}
+
+	length = ftell(stream);
+	if (length == -1) {
+		g_critical("ftell(3) failed: %s", strerror(errno));
+		fclose(stream);
+
+		return (-3);
+	}
+
+	if (fseek(stream, 0, SEEK_SET)) {
+		g_critical("fseek(3) failed: %s", strerror(errno));
+		fclose(stream);
+
+		return (-4);
+	}
+
+	if (length > buffer->allocated) {
+		data = realloc(buffer->data, length);
+		if (data == NULL) {
+			g_critical("realloc(3) failed: %s", strerror(errno));
+			fclose(stream);
+
+			return (-5);
+		}
+
+		buffer->data = data;
+		buffer->allocated = length;
+	}
+
+	buffer->length = length;
+
+	if (fread(buffer->data, 1, length, stream) != length) {
+		g_critical("fread(3) failed: %s", strerror(errno));
+		fclose(stream);
+
+		return (-6);
+	}
+
+	if (fclose(stream)) {
+		g_critical("fclose(3) failed: %s", strerror(errno));
+
+		return (-7);
+	}
+
+	return (0);
+}
+
+/*
+ * Loads a single file using one of the free buffers and passes the job back to the thread
+ * that called smf_file_load_many_from_func().  Runs in the worker threads.
+ */
+static void
+load_many_job_func(gpointer data, gpointer user_data)
+{
+	struct load_many_job *job = data;
+	struct load_many *load_many = user_data;
+	struct load_many_buffer *buffer = job->buffer;
+
+	/* There are as many buffers as workers or files in flight, so this never waits. */
+	if (buffer == NULL)
+		buffer = g_async_queue_pop(load_many->buffers);
+
+	if (job->is_read || !read_file_into_load_many_buffer(buffer, job->file_name))
+		job->smf = load_from_buffer(buffer->data, buffer->length, NULL, 1, NULL);
+
+	job->buffer = NULL;
+	g_async_queue_push(load_many->buffers, buffer);
+
+	if (job->smf == NULL)
+		job->error = g_error_new(G_IO_ERROR, G_IO_ERROR_FAILED, "Cannot load '%s'", job->file_name);
+
+	g_async_queue_push(load_many->finished_jobs, job);
+}
+
+#ifdef HAVE_LIBURING
+
+/* Maximum number of files read using a single pair of io_uring submissions. */
+#define URING_BATCH_SIZE 64
+
+enum uring_operation {
+	URING_OPEN,
+	URING_STATX,
+	URING_READ,
+	URING_CLOSE
+};
+
+/* Jobs are allocated by g_new0(), so the two lowest bits of their address are free for the operation. */
+#define URING_DATA(job, operation)	((void *)((uintptr_t)(job) | (operation)))
+#define URING_DATA_JOB(data)		((struct load_many_job *)((uintptr_t)(data) & ~(uintptr_t)3))
+#define URING_DATA_OPERATION(data)	((enum uring_operation)((uintptr_t)(data) & 3))
+
+/*
+ * Submits all the queued operations and processes their completions.  Returns 0 if everything
+ * went fine, -1 if io_uring cannot be used, but all the operations that were submitted completed,
+ * and -2 if some of them might still be running.
+ */
+static int
+submit_and_complete_uring(struct io_uring *ring, int number_of_operations)
+{
+	int i, ret, submitted;
+	struct io_uring_cqe *cqe;
+	struct load_many_job *job;
+
+	submitted = io_uring_submit(ring);
+	if (submitted != number_of_operations)
+		g_warning("SMF warning: io_uring_submit failed: %s", strerror(submitted < 0 ? -submitted : EIO));
+
+	/* Even if not all of them were submitted, buffers and descriptors are in use until these complete. */
+	for (i = 0; i < submitted; i++) {
+		do {
+			ret = io_uring_wait_cqe(ring, &cqe);
+		} while (ret == -EINTR);
+
+		if (ret < 0) {
+			g_warning("SMF warning: io_uring_wait_cqe failed: %s", strerror(-ret));
+			return (-2);
+		}
+
+		job = URING_DATA_JOB(io_uring_cqe_get_data(cqe));
+
+		switch (URING_DATA_OPERATION(io_uring_cqe_get_data(cqe))) {
+		case URING_OPEN:
+			job->fd = cqe->res;
+			break;
+
+		case URING_STATX:
+			/* Reusing fd would need another round trip; mark the failure by impossible size. */
+			if (cqe->res < 0)
+				job->statx.stx_size = (__u64)-1;
+			break;
+
+		case URING_READ:
+			job->is_read = (cqe->res >= 0 && cqe->res == job->buffer->length);
+			break;
+
+		case URING_CLOSE:
+			/* The descriptor is gone even if close(2) reported an error. */
+			job->fd = -1;
+			break;
+		}
+
+		io_uring_cqe_seen(ring, cqe);
+	}
+
+	return (submitted == number_of_operations ? 0 : -1);
+}
+
+/*
+ * Undoes what read_jobs_with_uring() did to the jobs, after "error" returned by submit_and_complete_uring(),
+ * so that load_many_job_func() reads all of them using stdio.  If some operations might still be running,
+ * buffers of the jobs are not reused, as they might still get written to, and files are left open,
+ * as their descriptors might get closed and reused by then.
+ */
+static void
+abandon_uring_jobs(struct load_many_job **jobs, int number_of_jobs, int error, struct load_many *load_many)
+{
+	int i;
+	struct load_many_job *job;
+
+	for (i = 0; i < number_of_jobs; i++) {
+		job = jobs[i];
+
+		if (job->buffer != NULL) {
+			if (error == -2)
+				g_async_queue_push(load_many->buffers, g_new0(struct load_many_buffer, 1));
+			else
+				g_async_queue_push(load_many->buffers, job->buffer);
+
+			job->buffer = NULL;
+		}
+
+		job->is_read = 0;
+
+		if (job->fd >= 0 && error != -2)
+			close(job->fd);
+
+		job->fd = -1;
+	}
+}
+
+/*
+ * Reads "number_of_jobs" files using io_uring: first, all of them are opened and statx(2)-ed in
+ * one submission, then read and closed in another one.  Files that could not be read this way,
+ * including those that got shorter in the meantime, are left for load_many_job_func() to read using
+ * stdio, which also reports the error, if any.  Returns -1 if io_uring cannot be used anymore;
+ * none of the files are read then.
+ */
+static int
+read_jobs_with_uring(struct io_uring *ring, struct load_many_job **jobs, int number_of_jobs,
+	struct load_many *load_many)
+{
+	int i, number_of_operations = 0, ret;
+	void *data;
+	struct io_uring_sqe *sqe;
+	struct load_many_job *job;
+	struct load_many_buffer *buffer;
+
+	for (i = 0; i < number_of_jobs; i++) {
+		job = jobs[i];
+		job->fd = -1;
+
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_openat(sqe, AT_FDCWD, job->file_name, O_RDONLY | O_BINARY, 0);
+		io_uring_sqe_set_data(sqe, URING_DATA(job, URING_OPEN));
+
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_statx(sqe, AT_FDCWD, job->file_name, 0, STATX_SIZE, &job->statx);
+		io_uring_sqe_set_data(sqe, URING_DATA(job, URING_STATX));
+
+		number_of_operations += 2;
+	}
+
+	ret = submit_and_complete_uring(ring, number_of_operations);
+	number_of_operations = 0;
+
+	for (i = 0; i < number_of_jobs && ret == 0; i++) {
+		job = jobs[i];
+
+		if (job->fd < 0)
+			continue;
+
+		if (job->statx.stx_size <= G_MAXINT) {
+			/* There are as many buffers as files in flight, so this never waits. */
+			buffer = g_async_queue_pop(load_many->buffers);
+
+			if (job->statx.stx_size > buffer->allocated) {
+				data = realloc(buffer->data, job->statx.stx_size);
+				if (data == NULL) {
+					g_async_queue_push(load_many->buffers, buffer);
+					buffer = NULL;
+				} else {
+					buffer->data = data;
+					buffer->allocated = job->statx.stx_size;
+				}
+			}
+
+			if (buffer != NULL) {
+				job->buffer = buffer;
+				buffer->length = job->statx.stx_size;
+
+				sqe = io_uring_get_sqe(ring);
+				io_uring_prep_read(sqe, job->fd, buffer->data, buffer->length, 0);
+				io_uring_sqe_set_data(sqe, URING_DATA(job, URING_READ));
+
+				/* Hard link, so that the file gets closed even if reading fails. */
+				sqe->flags |= IOSQE_IO_HARDLINK;
+				number_of_operations++;
+			}
+		}
+
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_close(sqe, job->fd);
+		io_uring_sqe_set_data(sqe, URING_DATA(job, URING_CLOSE));
+		number_of_operations++;
+	}
+
+	if (ret == 0 && number_of_operations > 0)
+		ret = submit_and_complete_uring(ring, number_of_operations);
+
+	if (ret) {
+		abandon_uring_jobs(jobs, number_of_jobs, ret, load_many);
+		return (-1);
+	}
+
+	return (0);
+}
+
+#endif /* HAVE_LIBURING */
+
+/**
+ * smf_file_load_many_from_func:
+ * @next_file_name: (scope call): function returning path of the next file to load, or %NULL
+ *   if there are no more files.
+ * @next_file_name_data: (closure next_file_name): the data to pass to @next_file_name.
+ * @max_threads: Maximum number of files loaded at the same time; zero or less means the number
+ *   of processors.
+ * @max_in_flight: Maximum number of files taken from @next_file_name that were not yet passed
+ *   to @func; zero or less means twice @max_threads.
+ * @func: (scope call): function called with every file once it is loaded.
+ * @user_data: (closure func): the data to pass to @func.
+ *
+ * Loads many SMF files, like calling smf_file_load() for each of them, using a pool of worker
+ * threads.  Both @next_file_name and @func are called from the calling thread only, @func in
+ * the order in which the files finished loading - which is not necessarily the order in which
+ * they were returned by @next_file_name.  @max_in_flight limits the number of files whose
+ * events are in memory at the same time, no matter how slow @func is.
+ *
+ * If libsmf was built with liburing, files are opened, statx(2)-ed and read by the calling thread
+ * in batches, using io_uring, and the workers only parse them.  This saves a lot of system calls
+ * when loading large numbers of small files.  Where io_uring is not available at runtime, files
+ * are read using stdio, just like smf_file_load() does.
+ *
+ * Returns: Number of files that were loaded successfully.
+ *
+ * Since: 1.4
+ */
+int
+smf_file_load_many_from_func(SmfFileNameFunc next_file_name, gpointer next_file_name_data,
+	int max_threads, int max_in_flight, SmfFileLoadManyFunc func, gpointer user_data)
+{
+	int i, in_flight = 0, loaded = 0, no_more_files = 0, number_of_buffers, number_of_new_jobs, refill_limit;
+	const char *file_name;
+	struct load_many load_many;
+	struct load_many_buffer *buffer;
+	struct load_many_job *job, **new_jobs;
+	GThreadPool *pool = NULL;
+	GError *error = NULL;
+#ifdef HAVE_LIBURING
+	int use_uring;
+	struct io_uring ring;
+#endif
+
+	if (max_threads <= 0)
+		max_threads = g_get_num_processors();
+
+	if (max_in_flight <= 0)
+		max_in_flight = 2 * max_threads;
+
+	new_jobs = malloc(max_in_flight * sizeof(*new_jobs));
+	if (new_jobs == NULL) {
+		g_critical("Cannot allocate memory in smf_file_load_many_from_func(): %s", strerror(errno));
+		return (0);
+	}
+
+	number_of_buffers = max_threads;
+
+	/* Take new files only when enough of them finished loading. */
+	refill_limit = max_in_flight - 1;
+
+#ifdef HAVE_LIBURING
+	use_uring = (io_uring_queue_init(2 * MIN(max_in_flight, URING_BATCH_SIZE), &ring, 0) == 0);
+
+	/* Files are read before they get to the workers, so every file in flight needs its own buffer. */
+	if (use_uring) {
+		number_of_buffers = max_in_flight;
+		refill_limit = max_in_flight / 2;
+	}
+#endif
+
+	load_many.buffers = g_async_queue_new();
+	load_many.finished_jobs = g_async_queue_new();
+
+	for (i = 0; i < number_of_buffers; i++)
+		g_async_queue_push(load_many.buffers, g_new0(struct load_many_buffer, 1));
+
+	if (max_threads > 1) {
+		pool = g_thread_pool_new(load_many_job_func, &load_many, max_threads, FALSE, &error);
+		if (pool == NULL) {
+			g_warning("SMF warning: Cannot create thread pool, loading in single thread: %s", error->message);
+			g_error_free(error);
+			error = NULL;
+		}
+	}
+
+	for (;;) {
+		number_of_new_jobs = 0;
+
+		while (!no_more_files && in_flight <= refill_limit && in_flight + number_of_new_jobs < max_in_flight) {
+			file_name = next_file_name(next_file_name_data);
+			if (file_name == NULL) {
+				no_more_files = 1;
+				break;
+			}
+
+			job = g_new0(struct load_many_job, 1);
+			job->file_name = g_strdup(file_name);
+			new_jobs[number_of_new_jobs++] = job;
+		}
+
+#ifdef HAVE_LIBURING
+		for (i = 0; use_uring && i < number_of_new_jobs; i += URING_BATCH_SIZE) {
+			if (read_jobs_with_uring(&ring, new_jobs + i, MIN(number_of_new_jobs - i, URING_BATCH_SIZE), &load_many)) {
+				g_warning("SMF warning: Cannot use io_uring, reading files using stdio.");
+				io_uring_queue_exit(&ring);
+				use_uring = 0;
+			}
+		}
+#endif
+
+		for (i = 0; i < number_of_new_jobs; i++) {
+			job = new_jobs[i];
+			in_flight++;
+
+			if (pool == NULL) {
+				load_many_job_func(job, &load_many);
+				continue;
+			}
+
+			if (!g_thread_pool_push(pool, job, &error)) {
+				g_warning("SMF warning: Cannot start thread, loading file in calling thread: %s", error->message);
+				g_error_free(error);
+				error = NULL;
+
+				load_many_job_func(job, &load_many);
+			}
+		}
+
+		if (in_flight == 0)
+			break;
+
+		job = g_async_queue_pop(load_many.finished_jobs);
+		in_flight--;
+
+		if (job->smf != NULL)
+			loaded++;
+
+		/* Ownership of the SMF goes to the callback. */
+		func(job->file_name, job->smf, job->error, user_data);
+
+		g_clear_error(&job->error);
+		g_free(job->file_name);
+		g_free(job);
+	}
+
+	if (pool != NULL)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+#ifdef HAVE_LIBURING
+	if (use_uring)
+		io_uring_queue_exit(&ring);
+#endif
+
+	while ((buffer = g_async_queue_try_pop(load_many.buffers)) != NULL) {
+		free(buffer->data);
+		g_free(buffer);
+	}
+
+	g_async_queue_unref(load_many.buffers);
+	g_async_queue_unref(load_many.finished_jobs);
+	free(new_jobs);
+
+	return (loaded);
+}
+
+struct file_name_array {
+	const char	**file_names;
+	int		number_of_files;
+	int		next;
+};
+
+static const char *
+next_file_name_from_array(gpointer user_data)
+{
+	struct file_name_array *array = user_data;
+
+	if (array->next >= array->number_of_files)
+		return (NULL);
+
+	return (array->file_names[array->next++]);
+}
+
+/**
+ * smf_file_load_many:
+ * @file_names: (array length=number_of_files): Paths to the files.
+ * @number_of_files: Number of paths in @file_names.
+ * @max_threads: Maximum number of files loaded at the same time; zero or less means the number
+ *   of processors.
+ * @max_in_flight: Maximum number of files loaded, but not yet passed to @func; zero or less
+ *   means twice @max_threads.
+ * @func: (scope call): function called with every file once it is loaded.
+ * @user_data: (closure): the data to pass to @func.
+ *
+ * Loads all the files given using a pool of worker threads.  See smf_file_load_many_from_func().
+ *
+ * Returns: Number of files that were loaded successfully.
+ *
+ * Since: 1.4
+ */
+int
+smf_file_load_many(const char **file_names, int number_of_files, int max_threads, int max_in_flight,
+	SmfFileLoadManyFunc func, gpointer user_data)
+{
+	struct file_name_array array;
+
+	array.file_names = file_names;
+	array.number_of_files = number_of_files;
+	array.next = 0;
+
+	return (smf_file_load_many_from_func(next_file_name_from_array, &array, max_threads, max_in_flight,
+		func, user_data));
+}
+
+/*
+ * Push parser.  Unlike the loaders above, it never sees the whole file; bytes come in fragments
+ * of arbitrary size, and whatever could not be parsed yet - an incomplete chunk header or event -
+ * is kept in parser->pending until the rest of it arrives.
+ */
+
+enum parser_state {
+	PARSER_MTHD,
+	PARSER_CHUNK_HEADER,
+	PARSER_MTRK_EVENTS,
+	PARSER_SKIP_CHUNK,
+	PARSER_DONE,
+	PARSER_FINISHED,
+	PARSER_FAILED
+};
+
+/**
+ * SmfParser:
+ *
+ * Incremental SMF loader, fed with the file contents piece by piece.  See smf_parser_new().
+ */
+struct _SmfParser {
+	enum parser_state	state;
+	smf_t			*smf;
+	smf_track_t		*track;
+	int			chunk_remaining;
+	int			number_of_chunks;
+	int			last_status;
+	GByteArray		*pending;
+
+	/* Time of the latest event parsed so far, in any track. */
+	int			last_pulses;
+	/* Used for computing ->time_seconds of the events in the current track. */
+	int			tempo_number;
+	/* Nonzero if the tempo map has to be rebuilt once the current track is complete. */
+	int			tempo_map_stale;
+	/* Events of the current track are allocated from this. */
+	smf_arena_t		*arena;
+
+	SmfParserEventFunc	event_func;
+	gpointer		event_func_data;
+	GDestroyNotify		event_func_notify;
+
+	SmfParserTrackFunc	track_func;
+	gpointer		track_func_data;
+	GDestroyNotify		track_func_notify;
+
+	int			ref_count;
+};
+
+#if HAVE_INTROSPECTION
+G_DEFINE_BOXED_TYPE (SmfProbe, smf_probe,
+                     smf_probe_ref, smf_probe_unref);
+
+G_DEFINE_BOXED_TYPE (SmfParser, smf_parser,
+                     smf_parser_ref, smf_parser_unref);
+#endif /* HAVE_INTROSPECTION */
+
+/*
+ * Returns the number of bytes decode_next_event() needs in order to decode the event at "buf" without
+ * running into the end of the buffer, or 0 if "buffer_length" bytes are not enough to tell.  Errs on the
+ * side of asking for more; it only decides when to try decoding, it does not validate anything.
+ */
+static int
+event_bytes_needed(const unsigned char *buf, const int buffer_length, int last_status)
+{
+	int offset = 0, status, length = 0, vlq_length = 0;
+
+	/* Delta time. */
+	while (offset < buffer_length && (buf[offset] & 0x80) && offset < 4)
+		offset++;
+
+	if (offset >= buffer_length)
+		return (0);
+
+	offset++;
+
+	if (offset >= buffer_length)
+		return (0);
+
+	if (is_status_byte(buf[offset]))
+		status = buf[offset++];
+	else
+		status = last_status;
+
+	/* Metaevent: type, length and "length" bytes of data. */
+	if (status == 0xFF) {
+		if (offset + 2 > buffer_length)
+			return (0);
+
+		return (offset + 2 + buf[offset + 1]);
+	}
+
+	/* SysEx or escaped event: VLQ length and data.  Decoder wants one byte past it, though. */
+	if (is_sysex_byte(status) || is_escape_byte(status)) {
+		while (offset + vlq_length < buffer_length && vlq_length < 4) {
+			length = (length << 7) + (buf[offset + vlq_length] & 0x7F);
+
+			if (!(buf[offset + vlq_length++] & 0x80))
+				return (MAX(offset + vlq_length + length + 1, offset + 3));
+		}
+
+		return (vlq_length < 4 ? 0 : offset + vlq_length);
+	}
+
+	/* Anything else is at most two data bytes long. */
+	return (offset + 2);
+}
+
+/*
+ * Appends the event to the current track, keeping the tempo map and ->time_seconds up to date.
+ * Tempo changes past everything parsed so far simply get added to the tempo map.  Others,
+ * e.g. these in track 2 preceding the last event of track 1, require rebuilding the whole map;
+ * that is done once the track is complete, instead of after every such event.
+ */
+static void
+parser_append_event(SmfParser *parser, smf_event_t *event, int delta)
+{
+	int old_length_pulses = smf_track_length_pulses(parser->track);
+
+	smf_track_append_parsed_event(parser->track, event, delta);
+	smf_file_track_length_changed(parser->smf, old_length_pulses, event->time_pulses);
+	smf_track_events_changed(parser->track);
+
+	if (old_length_pulses == -1)
+		smf_track_position_changed(parser->track);
+
+	if (smf_event_is_tempo_change_or_time_signature(event)) {
+		if (event->time_pulses >= parser->last_pulses && !parser->tempo_map_stale)
+			maybe_add_to_tempo_map(event);
+		else
+			parser->tempo_map_stale = 1;
+	}
+
+	event->time_seconds = seconds_from_pulses_walking(parser->smf, event->time_pulses, &parser->tempo_number);
+
+	if (event->time_pulses > parser->last_pulses)
+		parser->last_pulses = event->time_pulses;
+}
+
+/*
+ * Called when the parser is done with the current track, either because of EOT or error.
+ */
+static void
+parser_finish_track(SmfParser *parser)
+{
+	smf_track_t *track = parser->track;
+
+	parser->track = NULL;
+	parser->state = PARSER_SKIP_CHUNK;
+
+	smf_arena_unref(parser->arena);
+	parser->arena = NULL;
+
+	if (parser->tempo_map_stale) {
+		smf_file_create_tempo_map_and_compute_seconds(parser->smf);
+		parser->tempo_map_stale = 0;
+	}
+
+	if (parser->track_func != NULL)
+		parser->track_func(track, parser->track_func_data);
+}
+
+/*
+ * Parses as much of "buf" as it can.  Returns the number of bytes consumed, or value < 0 in case
+ * of error.  If "at_end" is nonzero, there is no more data coming, so incomplete events get
+ * handled the way parse_mtrk_events() would handle them.
+ */
+static int
+parser_consume(SmfParser *parser, const unsigned char *buf, const int buffer_length, int at_end)
+{
+	int consumed = 0, available, needed, ret;
+	const unsigned char *p;
+	const struct chunk_header_struct *chunk;
+	struct decoded_event decoded;
+	smf_event_t *event;
+	smf_t *smf = parser->smf;
+
+	for (;;) {
+		p = buf + consumed;
+		available = buffer_length - consumed;
+
+		switch (parser->state) {
+		case PARSER_MTHD:
+			if (available < sizeof(struct mthd_chunk_struct))
+				return (consumed);
+
+			/* parse_mthd_chunk() does all the checking; just make it look at what we have. */
+			smf->file_buffer = (void *)p;
+			smf->file_buffer_length = sizeof(struct mthd_chunk_struct);
+			smf->next_chunk_offset = 0;
+
+			ret = parse_mthd_chunk(smf);
+
+			smf->file_buffer = NULL;
+			smf->file_buffer_length = 0;
+			smf->next_chunk_offset = -1;
+
+			if (ret)
+				return (-1);
+
+			consumed += sizeof(struct mthd_chunk_struct);
+			parser->state = PARSER_CHUNK_HEADER;
+			break;
+
+		case PARSER_CHUNK_HEADER:
+			/* Anything past the last track is ignored, just like smf_file_load() does. */
+			if (parser->number_of_chunks == smf->expected_number_of_tracks) {
+				parser->state = PARSER_DONE;
+				break;
+			}
+
+			if (available < sizeof(struct chunk_header_struct))
+				return (consumed);
+
+			chunk = (const struct chunk_header_struct *)p;
+
+			if (!isalpha(chunk->id[0]) || !isalpha(chunk->id[1]) || !isalpha(chunk->id[2]) || !isalpha(chunk->id[3])) {
+				g_critical("SMF error: chunk signature contains at least one non-alphanumeric byte.");
+				parser->state = PARSER_DONE;
+				break;
+			}
+
+			consumed += sizeof(struct chunk_header_struct);
+			parser->number_of_chunks++;
+			parser->chunk_remaining = ntohl(chunk->length);
+
+			if (!chunk_signature_matches(chunk, "MTrk")) {
+				g_warning("SMF warning: Expected MTrk signature, got %c%c%c%c instead; ignoring this chunk.",
+					chunk->id[0], chunk->id[1], chunk->id[2], chunk->id[3]);
+				g_warning("SMF warning: Cannot load track.");
+
+				parser->state = PARSER_SKIP_CHUNK;
+				break;
+			}
+
+			parser->track = smf_track_new();
+			if (parser->track == NULL)
+				return (-2);
+
+			smf_file_add_track(smf, parser->track);
+			parser->last_status = 0;
+			parser->tempo_number = 0;
+
+			/* Not sized from the chunk length; it may well be bogus, and the data is not there yet anyway. */
+			parser->arena = smf_arena_new(0);
+			if (parser->arena == NULL)
+				return (-2);
+			parser->state = PARSER_MTRK_EVENTS;
+			break;
+
+		case PARSER_MTRK_EVENTS:
+			available = MIN(available, parser->chunk_remaining);
+
+			/* Unless this is all there is going to be, wait until the whole event is there. */
+			if (available < parser->chunk_remaining && !at_end) {
+				needed = event_bytes_needed(p, available, parser->last_status);
+				if (needed == 0 || needed > available)
+					return (consumed);
+			}
+
+			if (decode_next_event(p, available, &decoded, parser->last_status)) {
+				g_critical("Unable to parse MIDI event; truncating track.");
+
+				event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
+				if (event == NULL) {
+					g_critical("smf_event_new_from_bytes failed.");
+					return (-3);
+				}
+
+				parser_append_event(parser, event, 0);
+				parser_finish_track(parser);
+				break;
+			}
+
+			event = new_decoded_event(&decoded, parser->arena, NULL);
+			if (event == NULL)
+				return (-4);
+
+			if (extract_midi_event(&decoded, event, NULL)) {
+				smf_event_unref(event);
+				return (-5);
+			}
+
+			parser_append_event(parser, event, decoded.delta_time_pulses);
+
+			parser->last_status = event->midi_buffer[0];
+			parser->chunk_remaining -= decoded.length;
+			consumed += decoded.length;
+
+			if (parser->event_func != NULL)
+				parser->event_func(event, parser->event_func_data);
+
+			if (event_is_end_of_track(event))
+				parser_finish_track(parser);
+			break;
+
+		case PARSER_SKIP_CHUNK:
+			available = MIN(available, parser->chunk_remaining);
+			parser->chunk_remaining -= available;
+			consumed += available;
+
+			if (parser->chunk_remaining > 0)
+				return (consumed);
+
+			parser->state = PARSER_CHUNK_HEADER;
+			break;
+
+		case PARSER_DONE:
+			return (buffer_length);
+
+		default:
+			assert(!"parser_consume() called in wrong state");
+			return (-6);
+		}
+	}
+}
+
+/**
+ * smf_parser_new:
+ *
+ * Creates new push parser.  Parser builds an #SmfFile just like smf_file_load() would,
+ * but instead of reading the whole file at once, it gets fed with its contents, in pieces
+ * of whatever size, using smf_parser_feed().  This way, processing can start before the whole
+ * file arrives, and there is never a need to keep all of it in memory.  Once there is no more
+ * data, call smf_parser_finish() to get the #SmfFile.
+ *
+ * Returns: (transfer full): New parser.
+ *
+ * Since: 1.4
+ */
+SmfParser *
+smf_parser_new(void)
+{
+	SmfParser *parser = malloc(sizeof(SmfParser));
+	if (parser == NULL) {
+		g_critical("Cannot allocate SmfParser structure: %s", strerror(errno));
+		return (NULL);
+	}
+
+	memset(parser, 0, sizeof(SmfParser));
+
+	parser->smf = smf_file_new();
+	if (parser->smf == NULL) {
+		free(parser);
+		return (NULL);
+	}
+
+	parser->pending = g_byte_array_new();
+	parser->state = PARSER_MTHD;
+	parser->ref_count = 1;
+
+	return (parser);
+}
+
+/**
+ * smf_parser_ref:
+ * @parser: the parser
+ *
+ * Returns: (transfer full): @parser, with reference count increased by one.
+ *
+ * Since: 1.4
+ */
+SmfParser *
+smf_parser_ref(SmfParser *parser)
+{
+	g_atomic_int_inc(&parser->ref_count);
+	return (parser);
+}
+
+/**
+ * smf_parser_unref:
+ * @parser: the parser
+ *
+ * Decreases reference count of the parser, freeing it when it drops to zero.
+ * The #SmfFile being built, if any, is unreferenced too.
+ *
+ * Since: 1.4
+ */
+void
+smf_parser_unref(SmfParser *parser)
+{
+	if (!g_atomic_int_dec_and_test(&parser->ref_count))
+		return;
+
+	smf_parser_set_event_func(parser, NULL, NULL, NULL);
+	smf_parser_set_track_func(parser, NULL, NULL, NULL);
+
+	if (parser->smf != NULL)
+		smf_file_unref(parser->smf);
+
+	if (parser->arena != NULL)
+		smf_arena_unref(parser->arena);
+
+	g_byte_array_free(parser->pending, TRUE);
+
+	memset(parser, 0, sizeof(SmfParser));
+	free(parser);
+}
+
+/**
+ * smf_parser_set_event_func:
+ * @parser: the parser
+ * @func: (allow-none) (scope notified) (closure user_data) (destroy notify):
+ *   function to call for every event parsed, or %NULL.
+ * @user_data: data passed to @func
+ * @notify: (allow-none): function to free @user_data with, when it is no longer needed
+ *
+ * Sets function to be called by smf_parser_feed() or smf_parser_finish() with every
+ * event, right after it was added to its track.  Note that #SmfEvent.time_seconds may
+ * still change later, if some track that is yet to come changes tempo.
+ *
+ * Since: 1.4
+ */
+void
+smf_parser_set_event_func(SmfParser *parser, SmfParserEventFunc func, gpointer user_data, GDestroyNotify notify)
+{
+	if (parser->event_func_notify != NULL)
+		parser->event_func_notify(parser->event_func_data);
+
+	parser->event_func = func;
+	parser->event_func_data = user_data;
+	parser->event_func_notify = notify;
+}
+
+/**
+ * smf_parser_set_track_func:
+ * @parser: the parser
+ * @func: (allow-none) (scope notified) (closure user_data) (destroy notify):
+ *   function to call for every track parsed, or %NULL.
+ * @user_data: data passed to @func
+ * @notify: (allow-none): function to free @user_data with, when it is no longer needed
+ *
+ * Sets function to be called by smf_parser_feed() or smf_parser_finish() with every
+ * track, once all of its events were parsed.
+ *
+ * Since: 1.4
+ */
+void
+smf_parser_set_track_func(SmfParser *parser, SmfParserTrackFunc func, gpointer user_data, GDestroyNotify notify)
+{
+	if (parser->track_func_notify != NULL)
+		parser->track_func_notify(parser->track_func_data);
+
+	parser->track_func = func;
+	parser->track_func_data = user_data;
+	parser->track_func_notify = notify;
+}
+
+/**
+ * smf_parser_get_file:
+ * @parser: the parser
+ *
+ * Returns: (transfer none): #SmfFile being built, with all the tracks and events parsed so far,
+ *   or %NULL if smf_parser_finish() was already called.
+ *
+ * Since: 1.4
+ */
+SmfFile *
+smf_parser_get_file(SmfParser *parser)
+{
+	return (parser->smf);
+}
+
+/**
+ * smf_parser_feed:
+ * @parser: the parser
+ * @buffer: (array length=buffer_length) (element-type guint8) (transfer none):
+ *   next piece of the SMF file.
+ * @buffer_length: length of @buffer
+ *
+ * Parses as much of the data as possible.  Bytes that cannot be parsed yet, because
+ * the rest of the event or chunk header did not arrive yet, are kept by the parser.
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.  After an error, the parser
+ *   refuses further data and smf_parser_finish() returns %NULL.
+ *
+ * Since: 1.4
+ */
+int
+smf_parser_feed(SmfParser *parser, const void *buffer, const int buffer_length)
+{
+	int consumed;
+
+	if (parser->state == PARSER_FAILED || parser->state == PARSER_FINISHED) {
+		g_critical("smf_parser_feed: parser is finished or failed already.");
+		return (-1);
+	}
+
+	assert(buffer_length >= 0);
+
+	if (parser->pending->len == 0) {
+		/* Common case: parse directly from the caller's buffer, keeping only the incomplete tail. */
+		consumed = parser_consume(parser, buffer, buffer_length, 0);
+		if (consumed < 0)
+			goto error;
+
+		g_byte_array_append(parser->pending, (const guint8 *)buffer + consumed, buffer_length - consumed);
+
+	} else {
+		g_byte_array_append(parser->pending, buffer, buffer_length);
+
+		consumed = parser_consume(parser, parser->pending->data, parser->pending->len, 0);
+		if (consumed < 0)
+			goto error;
+
+		g_byte_array_remove_range(parser->pending, 0, consumed);
+	}
+
+	return (0);
+
+error:
+	parser->state = PARSER_FAILED;
+	g_byte_array_set_size(parser->pending, 0);
+
+	return (-2);
+}
+
+/**
+ * smf_parser_finish:
+ * @parser: the parser
+ *
+ * Tells the parser there is no more data.  Incomplete track at the end gets truncated,
+ * the same way smf_file_load() does it.
+ *
+ * Returns: (transfer full): Loaded SMF or %NULL, if loading failed.
+ *
+ * Since: 1.4
+ */
+SmfFile *
+smf_parser_finish(SmfParser *parser)
+{
+	smf_t *smf;
+
+	if (parser->state == PARSER_FAILED || parser->state == PARSER_FINISHED)
+		return (NULL);
+
+	if (parser->state == PARSER_MTHD) {
+		g_critical("SMF error: file is too short, it cannot be a MIDI file.");
+		parser->state = PARSER_FAILED;
+
+		return (NULL);
+	}
+
+	if (parser_consume(parser, parser->pending->data, parser->pending->len, 1) < 0) {
+		parser->state = PARSER_FAILED;
+		g_byte_array_set_size(parser->pending, 0);
+
+		return (NULL);
+	}
+
+	g_byte_array_set_size(parser->pending, 0);
+
+	if (parser->state == PARSER_SKIP_CHUNK && parser->chunk_remaining > 0)
+		g_critical("SMF warning: malformed chunk; truncated file?");
+
+	smf = parser->smf;
+	parser->smf = NULL;
+	parser->state = PARSER_FINISHED;
+
+	if (smf->expected_number_of_tracks != smf->number_of_tracks) {
+		g_warning("SMF warning: MThd header declared %d tracks, but only %d found; continuing anyway.",
+				smf->expected_number_of_tracks, smf->number_of_tracks);
+
+		smf->expected_number_of_tracks = smf->number_of_tracks;
+	}
+
+	smf_file_rewind(smf);
+
+	return (smf);
+}
@@ -67,15 +67,95 @@ struct mthd_chunk_struct {
 #pragma pack()
 #endif
 
+/*
+ * Bump allocator for events created while loading; see smf_event_new_from_arena().
+ * All of its memory is freed at once, when the last reference goes away.
+ */
+typedef struct smf_arena_struct {
+	int			ref_count;
+	size_t			block_size;
+	struct arena_block	*last_block;
+	unsigned char		*next;
+	unsigned char		*end;
+} smf_arena_t;
+
+/* Allocations from the arena are aligned to this many bytes. */
+#define SMF_ARENA_ALIGNMENT	16
+
+smf_arena_t *smf_arena_new(size_t size_hint) G_GNUC_WARN_UNUSED_RESULT;
+smf_arena_t *smf_arena_ref(smf_arena_t *arena);
+void smf_arena_unref(smf_arena_t *arena);
+void *smf_arena_alloc(smf_arena_t *arena, size_t size) G_GNUC_WARN_UNUSED_RESULT;
+smf_event_t *smf_event_new_from_arena(smf_arena_t *arena, int length) G_GNUC_WARN_UNUSED_RESULT;
+
+/* Messages up to this long are kept in event->inline_buffer instead of allocating midi_buffer. */
+#define SMF_EVENT_INLINE_BUFFER_SIZE	((int)sizeof(((smf_event_t *)NULL)->inline_buffer))
+
+int smf_event_allocate_buffer(smf_event_t *event, int length) G_GNUC_WARN_UNUSED_RESULT;
+int smf_event_buffer_is_in_arena(const smf_event_t *event) G_GNUC_WARN_UNUSED_RESULT;
+
+/*
+ * Events of a track converted by smf_track_compact(), stored column by column.  Messages up to
+ * three bytes long - nearly all of them - are kept in status and data; longer ones are copied
+ * into payload, in whole, and payload_offset is their position there; -1 for the short ones.
+ */
+struct smf_event_columns {
+	int		*time_pulses;
+	double		*time_seconds;
+	int		*length;
+	unsigned char	*status;
+	unsigned char	(*data)[2];
+	int		*payload_offset;
+	unsigned char	*payload;
+};
+
+void smf_track_expand(smf_track_t *track);
+smf_event_t *smf_track_event_at(const smf_track_t *track, int index) G_GNUC_WARN_UNUSED_RESULT;
+int smf_track_find_first_event_at_or_after(const smf_track_t *track, int pulses, double seconds) G_GNUC_WARN_UNUSED_RESULT;
+const smf_event_t *smf_track_get_event_view(const smf_track_t *track, int event_number, smf_event_t *view) G_GNUC_WARN_UNUSED_RESULT;
+
+int smf_track_length_pulses(const smf_track_t *track) G_GNUC_WARN_UNUSED_RESULT;
+void smf_file_track_length_changed(smf_t *smf, int old_pulses, int new_pulses);
+void smf_track_position_changed(smf_track_t *track);
+void smf_track_events_changed(smf_track_t *track);
+
+/* Event in the timeline built by smf_file_set_timeline_index(). */
+struct smf_timeline_entry {
+	int		time_pulses;
+	double		time_seconds;
+	smf_track_t	*track;
+	int		event_number;
+};
+
+void smf_sift_down_timeline_entries(struct smf_timeline_entry *entries, int length, int index);
+
 void smf_track_add_event(smf_track_t *track, smf_event_t *event);
+void smf_track_add_events(smf_track_t *track, smf_event_t **events, int number_of_events, int compute_seconds);
+
+/* Bits of smf_tempo_t.set_by_events. */
+#define TEMPO_SET_MICROSECONDS_PER_QUARTER_NOTE	0x01
+#define TEMPO_SET_TIME_SIGNATURE		0x02
+
 void smf_file_init_tempo(smf_t *smf);
 void smf_file_fini_tempo(smf_t *smf);
 void smf_file_create_tempo_map_and_compute_seconds(smf_t *smf);
+void smf_file_invalidate_tempo_map(smf_t *smf, int pulses);
+void smf_file_invalidate_tempo_at(smf_t *smf, int pulses);
+int smf_file_copy_tempo_map(smf_t *smf, const smf_t *source) G_GNUC_WARN_UNUSED_RESULT;
+void maybe_update_time_seconds(smf_event_t *event);
 void maybe_add_to_tempo_map(smf_event_t *event);
+void maybe_add_metaevent_to_tempo_map(smf_t *smf, int pulses, const unsigned char *midi_buffer, int midi_buffer_length);
+double seconds_from_pulses(const smf_t *smf, int pulses) G_GNUC_WARN_UNUSED_RESULT;
+double seconds_from_pulses_walking(const smf_t *smf, int pulses, int *tempo_number) G_GNUC_WARN_UNUSED_RESULT;
+void smf_track_compute_seconds(smf_track_t *track);
+void smf_track_append_parsed_event(smf_track_t *track, smf_event_t *event, int delta);
+void smf_track_reserve_events(smf_track_t *track, int number_of_events);
+void smf_track_load_pending_events(smf_track_t *track);
 void remove_last_tempo_with_pulses(smf_t *smf, int pulses);
 int smf_event_is_tempo_change_or_time_signature(const smf_event_t *event) G_GNUC_WARN_UNUSED_RESULT;
 int smf_event_length_is_valid(const smf_event_t *event) G_GNUC_WARN_UNUSED_RESULT;
 int is_status_byte(const unsigned char status) G_GNUC_WARN_UNUSED_RESULT;
+int smf_event_buffer_is_mapped(const smf_event_t *event) G_GNUC_WARN_UNUSED_RESULT;
 
 #endif /* SMF_PRIVATE_H */
 
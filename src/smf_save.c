@@ -371,13 +371,25 @@ write_mtrk_length(smf_track_t *track)
 static int
 write_track(smf_track_t *track)
 {
-	int ret;
-	smf_event_t *event;
+	int ret, i;
+	smf_event_t *event, view;
 
 	ret = write_mtrk_header(track);
 	if (ret)
 		return (ret);
 
+	/* Do not create all the events of compacted track just to write them out. */
+	if (track->columns != NULL) {
+		for (i = 1; i <= track->number_of_events; i++) {
+			ret = write_event((smf_event_t *)smf_track_get_event_view(track, i, &view));
+			if (ret)
+				return (ret);
+		}
+
+		track->next_event_number = -1;
+		smf_track_position_changed(track);
+	}
+
 	while ((event = smf_track_get_next_event(track)) != NULL) {
 		ret = write_event(event);
 		if (ret)
@@ -496,7 +508,8 @@ smf_validate(smf_t *smf)
 {
 	int trackno, eventno, eot_found;
 	smf_track_t *track;
-	smf_event_t *event;
+	const smf_event_t *event;
+	smf_event_t view;
 
 	if (smf->format < 0 || smf->format > 2) {
 		g_critical("SMF error: smf->format is less than zero of greater than two.");
@@ -525,7 +538,7 @@ smf_validate(smf_t *smf)
 		eot_found = 0;
 
 		for (eventno = 1; eventno <= track->number_of_events; eventno++) {
-			event = smf_track_get_event_by_number(track, eventno);
+			event = smf_track_get_event_view(track, eventno, &view);
 			assert(event);
 
 			if (!smf_event_is_valid(event)) {
@@ -560,25 +573,37 @@ smf_validate(smf_t *smf)
 static void
 assert_smf_event_is_identical(const smf_event_t *a, const smf_event_t *b)
 {
-	assert(a->event_number == b->event_number);
-	assert(a->delta_time_pulses == b->delta_time_pulses);
 	assert(abs(a->time_pulses - b->time_pulses) <= 2);
 	assert(fabs(a->time_seconds - b->time_seconds) <= 0.01);
-	assert(a->track_number == b->track_number);
 	assert(a->midi_buffer_length == b->midi_buffer_length);
 	assert(memcmp(a->midi_buffer, b->midi_buffer, a->midi_buffer_length) == 0);
 }
 
+/*
+ * Events are looked at through smf_track_get_event_view(), so that checking a compacted track
+ * does not create all of its events.  Their ->event_number and ->delta_time_pulses might be out
+ * of date then, so these are checked using position of the event and time of the previous one.
+ */
 static void
 assert_smf_track_is_identical(const smf_track_t *a, const smf_track_t *b)
 {
-	int i;
+	int i, a_previous_pulses = 0, b_previous_pulses = 0;
+	smf_event_t a_view, b_view;
+	const smf_event_t *a_event, *b_event;
 
 	assert(a->track_number == b->track_number);
 	assert(a->number_of_events == b->number_of_events);
 
-	for (i = 1; i <= a->number_of_events; i++)
-		assert_smf_event_is_identical(smf_track_get_event_by_number(a, i), smf_track_get_event_by_number(b, i));
+	for (i = 1; i <= a->number_of_events; i++) {
+		a_event = smf_track_get_event_view(a, i, &a_view);
+		b_event = smf_track_get_event_view(b, i, &b_view);
+
+		assert_smf_event_is_identical(a_event, b_event);
+		assert(a_event->time_pulses - a_previous_pulses == b_event->time_pulses - b_previous_pulses);
+
+		a_previous_pulses = a_event->time_pulses;
+		b_previous_pulses = b_event->time_pulses;
+	}
 }
 
 static void
@@ -613,19 +638,12 @@ assert_smf_saved_correctly(const smf_t *smf, const char *file_name)
 
 #endif /* !NDEBUG */
 
-/**
- * smf_file_save:
- * @smf: SMF.
- * @file_name: Path to the file.
- *
- * Writes the contents of SMF to the file given.
- *
- * Returns: 0, if saving was successfull.
- *
- * Since: 1.4
+/*
+ * Does the work of smf_file_save() and smf_file_save_async().  If "cancellable" gets cancelled,
+ * remaining tracks are not written, the file is left untouched and -4 is returned.
  */
-int
-smf_file_save(smf_t *smf, const char *file_name)
+static int
+save_file(smf_t *smf, const char *file_name, GCancellable *cancellable)
 {
 	int i, error;
 	smf_track_t *track;
@@ -641,6 +659,11 @@ smf_file_save(smf_t *smf, const char *file_name)
 		return (-2);
 
 	for (i = 1; i <= smf->number_of_tracks; i++) {
+		if (g_cancellable_is_cancelled(cancellable)) {
+			free_buffer(smf);
+			return (-4);
+		}
+
 		track = smf_get_track_by_number(smf, i);
 
 		assert(track != NULL);
@@ -666,3 +689,105 @@ smf_file_save(smf_t *smf, const char *file_name)
 	return (0);
 }
 
+/**
+ * smf_file_save:
+ * @smf: SMF.
+ * @file_name: Path to the file.
+ *
+ * Writes the contents of SMF to the file given.
+ *
+ * Returns: 0, if saving was successfull.
+ *
+ * Since: 1.4
+ */
+int
+smf_file_save(smf_t *smf, const char *file_name)
+{
+	return (save_file(smf, file_name, NULL));
+}
+
+struct save_task_data {
+	smf_t	*smf;
+	char	*file_name;
+};
+
+static void
+save_task_data_free(gpointer data)
+{
+	struct save_task_data *save = data;
+
+	smf_file_unref(save->smf);
+	g_free(save->file_name);
+	g_free(save);
+}
+
+static void
+save_in_thread(GTask *task, G_GNUC_UNUSED gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	struct save_task_data *save = task_data;
+
+	if (save_file(save->smf, save->file_name, cancellable) == 0) {
+		g_task_return_boolean(task, TRUE);
+		return;
+	}
+
+	if (!g_task_return_error_if_cancelled(task))
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Cannot save '%s'", save->file_name);
+}
+
+/**
+ * smf_file_save_async:
+ * @smf: SMF.
+ * @file_name: Path to the file.
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the file is saved.
+ * @user_data: (closure): the data to pass to @callback.
+ *
+ * Writes the contents of SMF to the file given in a worker thread, like smf_file_save().
+ * When done, @callback is called in the thread-default main context of the caller; call
+ * smf_file_save_finish() from it to get the result.  Cancelling @cancellable stops saving
+ * before the next track, without touching the file.
+ *
+ * SMF is referenced until saving is finished.  Saving uses the playback position and internal
+ * buffers of @smf, so it must not be accessed before @callback is called.
+ *
+ * Since: 1.4
+ */
+void
+smf_file_save_async(smf_t *smf, const char *file_name, GCancellable *cancellable,
+	GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+	struct save_task_data *save;
+
+	save = g_new(struct save_task_data, 1);
+	save->smf = smf_file_ref(smf);
+	save->file_name = g_strdup(file_name);
+
+	task = g_task_new(NULL, cancellable, callback, user_data);
+	g_task_set_source_tag(task, smf_file_save_async);
+	g_task_set_task_data(task, save, save_task_data_free);
+
+	g_task_run_in_thread(task, save_in_thread);
+	g_object_unref(task);
+}
+
+/**
+ * smf_file_save_finish:
+ * @result: a #GAsyncResult passed to the callback of smf_file_save_async().
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Finishes saving started with smf_file_save_async().
+ *
+ * Returns: %TRUE, if saving was successfull; %FALSE with @error set otherwise.
+ *
+ * Since: 1.4
+ */
+gboolean
+smf_file_save_finish(GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+	g_return_val_if_fail(g_async_result_is_tagged(result, smf_file_save_async), FALSE);
+
+	return (g_task_propagate_boolean(G_TASK(result), error));
+}
@@ -39,8 +39,6 @@
 #include "smf.h"
 #include "smf_private.h"
 
-static double seconds_from_pulses(const smf_t *smf, int pulses);
-
 /*
  * If there is tempo starting at "pulses" already, return it.  Otherwise,
  * allocate new one, fill it with values from previous one (or default ones,
@@ -67,6 +65,7 @@ new_tempo(smf_t *smf, int pulses)
 
 	tempo->ref_count = 1;
 	tempo->time_pulses = pulses;
+	tempo->set_by_events = 0;
 
 	if (previous_tempo != NULL) {
 		tempo->microseconds_per_quarter_note = previous_tempo->microseconds_per_quarter_note;
@@ -83,6 +82,7 @@ new_tempo(smf_t *smf, int pulses)
 	}
 
 	g_ptr_array_add(smf->tempo_array, tempo);
+	smf->tempo_generation++;
 
 	if (pulses == 0)
 		tempo->time_seconds = 0.0;
@@ -92,6 +92,27 @@ new_tempo(smf_t *smf, int pulses)
 	return (tempo);
 }
 
+/*
+ * Returns number of the last tempo that starts before "pulses", or -1 if there is none.
+ * Tempo map is sorted, so this is a binary search.
+ */
+static int
+tempo_number_before_pulses(const smf_t *smf, int pulses)
+{
+	int low = 0, high = smf->tempo_array->len, middle;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+
+		if (((smf_tempo_t *)g_ptr_array_index(smf->tempo_array, middle))->time_pulses < pulses)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return (low - 1);
+}
+
 /**
  * smf_tempo_ref:
  * @tempo: the tempo
@@ -134,6 +155,8 @@ add_tempo(smf_t *smf, int pulses, int tempo)
 		return (-1);
 
 	smf_tempo->microseconds_per_quarter_note = tempo;
+	smf_tempo->set_by_events |= TEMPO_SET_MICROSECONDS_PER_QUARTER_NOTE;
+	smf->tempo_generation++;
 
 	return (0);
 }
@@ -149,54 +172,69 @@ add_time_signature(smf_t *smf, int pulses, int numerator, int denominator, int c
 	smf_tempo->denominator = denominator;
 	smf_tempo->clocks_per_click = clocks_per_click;
 	smf_tempo->notes_per_note = notes_per_note;
+	smf_tempo->set_by_events |= TEMPO_SET_TIME_SIGNATURE;
+	smf->tempo_generation++;
 
 	return (0);
 }
 
 /*
  * Internal:
+ *
+ * Adds metaevent, given as its MIDI data and time, to the tempo map of "smf",
+ * if it is Tempo Change or Time Signature.
  */
 void
-maybe_add_to_tempo_map(smf_event_t *event)
+maybe_add_metaevent_to_tempo_map(smf_t *smf, int pulses, const unsigned char *midi_buffer, int midi_buffer_length)
 {
-	if (!smf_event_is_metadata(event))
-		return;
-
-	assert(event->track != NULL);
-	assert(event->track->smf != NULL);
-	assert(event->midi_buffer_length >= 1);
+	assert(midi_buffer_length >= 1);
 
 	/* Tempo Change? */
-	if (event->midi_buffer[1] == 0x51) {
-		int new_tempo = (event->midi_buffer[3] << 16) + (event->midi_buffer[4] << 8) + event->midi_buffer[5];
+	if (midi_buffer[1] == 0x51) {
+		int new_tempo = (midi_buffer[3] << 16) + (midi_buffer[4] << 8) + midi_buffer[5];
 		if (new_tempo <= 0) {
 			g_critical("Ignoring invalid tempo change.");
 			return;
 		}
 
-		add_tempo(event->track->smf, event->time_pulses, new_tempo);
+		add_tempo(smf, pulses, new_tempo);
 	}
 
 	/* Time Signature? */
-	if (event->midi_buffer[1] == 0x58) {
+	if (midi_buffer[1] == 0x58) {
 		int numerator, denominator, clocks_per_click, notes_per_note;
 
-		if (event->midi_buffer_length < 7) {
+		if (midi_buffer_length < 7) {
 			g_critical("Time Signature event seems truncated.");
 			return;
 		}
 
-		numerator = event->midi_buffer[3];
-		denominator = (int)pow(2, event->midi_buffer[4]);
-		clocks_per_click = event->midi_buffer[5];
-		notes_per_note = event->midi_buffer[6];
+		numerator = midi_buffer[3];
+		denominator = (int)pow(2, midi_buffer[4]);
+		clocks_per_click = midi_buffer[5];
+		notes_per_note = midi_buffer[6];
 
-		add_time_signature(event->track->smf, event->time_pulses, numerator, denominator, clocks_per_click, notes_per_note);
+		add_time_signature(smf, pulses, numerator, denominator, clocks_per_click, notes_per_note);
 	}
 
 	return;
 }
 
+/*
+ * Internal:
+ */
+void
+maybe_add_to_tempo_map(smf_event_t *event)
+{
+	if (!smf_event_is_metadata(event))
+		return;
+
+	assert(event->track != NULL);
+	assert(event->track->smf != NULL);
+
+	maybe_add_metaevent_to_tempo_map(event->track->smf, event->time_pulses, event->midi_buffer, event->midi_buffer_length);
+}
+
 /*
  * Internal:
  *
@@ -223,22 +261,33 @@ remove_last_tempo_with_pulses(smf_t *smf, int pulses)
 		return;
 
 	g_ptr_array_remove_index(smf->tempo_array, smf->tempo_array->len - 1);
+	smf->tempo_generation++;
 }
 
+/*
+ * Returns time, in seconds, of "pulses", given that "tempo" is the tempo in effect at that time.
+ */
 static double
+seconds_from_pulses_and_tempo(const smf_t *smf, const smf_tempo_t *tempo, int pulses)
+{
+	assert(tempo->time_pulses <= pulses);
+
+	return (tempo->time_seconds + (double)(pulses - tempo->time_pulses) *
+		(tempo->microseconds_per_quarter_note / ((double)smf->ppqn * 1000000.0)));
+}
+
+/*
+ * Internal:
+ */
+double
 seconds_from_pulses(const smf_t *smf, int pulses)
 {
-	double seconds;
 	smf_tempo_t *tempo;
 
 	tempo = smf_get_tempo_by_pulses(smf, pulses);
 	assert(tempo);
-	assert(tempo->time_pulses <= pulses);
 
-	seconds = tempo->time_seconds + (double)(pulses - tempo->time_pulses) *
-		(tempo->microseconds_per_quarter_note / ((double)smf->ppqn * 1000000.0));
-
-	return (seconds);
+	return (seconds_from_pulses_and_tempo(smf, tempo, pulses));
 }
 
 static int
@@ -269,6 +318,8 @@ smf_file_create_tempo_map_and_compute_seconds(smf_t *smf)
 {
 	smf_event_t *event;
 
+	smf->tempo_map_dirty = 0;
+
 	smf_rewind(smf);
 	smf_file_init_tempo(smf);
 
@@ -286,6 +337,396 @@ smf_file_create_tempo_map_and_compute_seconds(smf_t *smf)
 	/* Not reached. */
 }
 
+/*
+ * Internal:
+ *
+ * Same as seconds_from_pulses(), but instead of looking up the tempo from the end of the tempo map,
+ * walks it forward starting from tempo number "*tempo_number", and leaves the number of the tempo
+ * in effect there.  Computing time of events sorted by time, starting with *tempo_number set to zero,
+ * takes one pass over the tempo map this way, no matter how long it is.
+ */
+double
+seconds_from_pulses_walking(const smf_t *smf, int pulses, int *tempo_number)
+{
+	smf_tempo_t *tempo, *next_tempo;
+
+	assert(smf->tempo_array->len > 0);
+	assert(*tempo_number >= 0 && *tempo_number < smf->tempo_array->len);
+
+	tempo = g_ptr_array_index(smf->tempo_array, *tempo_number);
+
+	/* Same rule as smf_file_get_tempo_by_pulses(): last tempo starting strictly before "pulses". */
+	while (*tempo_number + 1 < smf->tempo_array->len) {
+		next_tempo = g_ptr_array_index(smf->tempo_array, *tempo_number + 1);
+		if (next_tempo->time_pulses >= pulses)
+			break;
+
+		tempo = next_tempo;
+		(*tempo_number)++;
+	}
+
+	return (seconds_from_pulses_and_tempo(smf, tempo, pulses));
+}
+
+/*
+ * Returns ->time_pulses of the event at "index", without creating it if the track is compacted.
+ */
+static int
+time_pulses_at(const smf_track_t *track, int index)
+{
+	if (track->columns != NULL)
+		return (track->columns->time_pulses[index]);
+
+	return (smf_track_event_at(track, index)->time_pulses);
+}
+
+/*
+ * Sets ->time_seconds of the event at "index", in the columns too, if the track is compacted.
+ */
+static void
+set_time_seconds_at(smf_track_t *track, int index, double seconds)
+{
+	smf_event_t *event;
+
+	if (track->columns != NULL && track->columns->time_seconds != NULL)
+		track->columns->time_seconds[index] = seconds;
+
+	event = smf_track_event_at(track, index);
+	if (event != NULL)
+		event->time_seconds = seconds;
+}
+
+/*
+ * Brings the tempo map and ->time_seconds of the events up to date after an edit at "pulses".
+ * Neither tempo changes nor events before "pulses" depend on anything that happens at "pulses"
+ * or later, so this keeps the tempo map up to there and, starting in every track from the first
+ * event at "pulses" or later (found using binary search), does what
+ * smf_file_create_tempo_map_and_compute_seconds() does for the whole song.
+ */
+static void
+update_tempo_map_from_pulses(smf_t *smf, int pulses)
+{
+	int i, length = 0, tempo_number;
+	smf_track_t *track;
+	smf_event_t view;
+	const smf_event_t *event;
+	struct smf_timeline_entry *heap;
+
+	if (pulses <= 0) {
+		smf_file_create_tempo_map_and_compute_seconds(smf);
+		return;
+	}
+
+	smf->tempo_map_dirty = 0;
+
+	/* Tempo 0 starts at pulse 0, so it always stays. */
+	tempo_number = tempo_number_before_pulses(smf, pulses);
+	assert(tempo_number >= 0);
+	g_ptr_array_set_size(smf->tempo_array, tempo_number + 1);
+	smf->tempo_generation++;
+
+	/* Heap of the next event of every track, so that this takes O(N log T) for N events after "pulses". */
+	heap = g_new(struct smf_timeline_entry, smf->number_of_tracks + 1);
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_file_get_track_by_number(smf, i);
+
+		heap[length].event_number = smf_track_find_first_event_at_or_after(track, pulses, 0.0);
+		if (heap[length].event_number == -1)
+			continue;
+
+		heap[length].track = track;
+		heap[length].time_pulses = time_pulses_at(track, heap[length].event_number - 1);
+		length++;
+	}
+
+	for (i = length / 2 - 1; i >= 0; i--)
+		smf_sift_down_timeline_entries(heap, length, i);
+
+	/* Go through the rest of the events in the same order as smf_file_get_next_event() would. */
+	while (length > 0) {
+		track = heap[0].track;
+		event = smf_track_get_event_view(track, heap[0].event_number, &view);
+
+		if (smf_event_is_tempo_change_or_time_signature(event))
+			maybe_add_metaevent_to_tempo_map(smf, event->time_pulses, event->midi_buffer, event->midi_buffer_length);
+
+		set_time_seconds_at(track, heap[0].event_number - 1,
+			seconds_from_pulses_walking(smf, event->time_pulses, &tempo_number));
+
+		if (heap[0].event_number < track->number_of_events) {
+			heap[0].event_number++;
+			heap[0].time_pulses = time_pulses_at(track, heap[0].event_number - 1);
+		} else {
+			heap[0] = heap[--length];
+		}
+
+		if (length > 0)
+			smf_sift_down_timeline_entries(heap, length, 0);
+	}
+
+	g_free(heap);
+}
+
+/*
+ * Internal:
+ *
+ * Called when an edit at "pulses" made the tempo map out of date.  Updates it right away, unless
+ * smf_file_begin_edit() is in effect; then it's done by the outermost smf_file_end_edit().
+ */
+void
+smf_file_invalidate_tempo_map(smf_t *smf, int pulses)
+{
+	if (smf->edit_depth > 0) {
+		if (!smf->tempo_map_dirty || pulses < smf->tempo_map_dirty_pulses)
+			smf->tempo_map_dirty_pulses = pulses;
+
+		smf->tempo_map_dirty = 1;
+		return;
+	}
+
+	update_tempo_map_from_pulses(smf, pulses);
+}
+
+/*
+ * Brings the tempo map up to date after tempo changes or time signatures at "pulses", and nowhere
+ * else, were added or removed.  Entries of the tempo map after "pulses" depend on the events at
+ * "pulses" only through the fields they inherit, so instead of looking at all the events after
+ * "pulses", this rebuilds the entry at "pulses" from the events there, found using binary search,
+ * and then fixes up the rest of the tempo map, without touching any events.
+ */
+static void
+update_tempo_at_pulses(smf_t *smf, int pulses)
+{
+	int i, j, first_later;
+	smf_track_t *track;
+	smf_event_t view;
+	const smf_event_t *event;
+	smf_tempo_t *tempo, *previous_tempo;
+	GPtrArray *later_tempos;
+
+	if (pulses <= 0) {
+		update_tempo_map_from_pulses(smf, pulses);
+		return;
+	}
+
+	/* Take the entries after "pulses" out of the tempo map... */
+	first_later = tempo_number_before_pulses(smf, pulses) + 1;
+	assert(first_later >= 1);
+
+	later_tempos = g_ptr_array_new_with_free_func((GDestroyNotify)smf_tempo_unref);
+
+	for (i = first_later; i < smf->tempo_array->len; i++) {
+		tempo = g_ptr_array_index(smf->tempo_array, i);
+		if (tempo->time_pulses > pulses)
+			g_ptr_array_add(later_tempos, smf_tempo_ref(tempo));
+	}
+
+	g_ptr_array_set_size(smf->tempo_array, first_later);
+	smf->tempo_generation++;
+
+	/* ...recreate the one at "pulses", adding events in the same order as smf_file_get_next_event()... */
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i - 1);
+
+		j = smf_track_find_first_event_at_or_after(track, pulses, 0.0);
+		if (j == -1)
+			continue;
+
+		for (; j <= track->number_of_events; j++) {
+			event = smf_track_get_event_view(track, j, &view);
+			if (event->time_pulses != pulses)
+				break;
+
+			if (smf_event_is_tempo_change_or_time_signature(event))
+				maybe_add_metaevent_to_tempo_map(smf, pulses, event->midi_buffer, event->midi_buffer_length);
+		}
+	}
+
+	/* ...and put the rest back, updating whatever they inherit from their predecessors. */
+	for (i = 0; i < later_tempos->len; i++) {
+		previous_tempo = smf_file_get_last_tempo(smf);
+		tempo = g_ptr_array_index(later_tempos, i);
+
+		if (!(tempo->set_by_events & TEMPO_SET_MICROSECONDS_PER_QUARTER_NOTE))
+			tempo->microseconds_per_quarter_note = previous_tempo->microseconds_per_quarter_note;
+
+		if (!(tempo->set_by_events & TEMPO_SET_TIME_SIGNATURE)) {
+			tempo->numerator = previous_tempo->numerator;
+			tempo->denominator = previous_tempo->denominator;
+			tempo->clocks_per_click = previous_tempo->clocks_per_click;
+			tempo->notes_per_note = previous_tempo->notes_per_note;
+		}
+
+		tempo->time_seconds = seconds_from_pulses_and_tempo(smf, previous_tempo, tempo->time_pulses);
+
+		g_ptr_array_add(smf->tempo_array, smf_tempo_ref(tempo));
+	}
+
+	g_ptr_array_unref(later_tempos);
+
+	/* Looking up events above might have computed their ->time_seconds from the partial tempo map. */
+	smf->tempo_generation++;
+}
+
+/*
+ * Internal:
+ *
+ * Like smf_file_invalidate_tempo_map(), but for an edit that added or removed tempo changes or time
+ * signatures at "pulses" only.  With lazy seconds, that takes time proportional to the size of
+ * the tempo map, not to the number of events after "pulses".
+ */
+void
+smf_file_invalidate_tempo_at(smf_t *smf, int pulses)
+{
+	if (smf->edit_depth > 0 || !smf->lazy_seconds) {
+		smf_file_invalidate_tempo_map(smf, pulses);
+		return;
+	}
+
+	update_tempo_at_pulses(smf, pulses);
+}
+
+/*
+ * Internal:
+ *
+ * With lazy seconds, brings ->time_seconds of the event up to date, if the tempo map changed
+ * since it was computed.
+ */
+void
+maybe_update_time_seconds(smf_event_t *event)
+{
+	smf_t *smf;
+
+	if (event->track == NULL || event->track->smf == NULL || !event->track->smf->lazy_seconds)
+		return;
+
+	smf = event->track->smf;
+
+	if (event->seconds_generation == smf->tempo_generation)
+		return;
+
+	event->time_seconds = seconds_from_pulses(smf, event->time_pulses);
+	event->seconds_generation = smf->tempo_generation;
+}
+
+/**
+ * smf_event_get_time_seconds:
+ * @event: the event
+ *
+ * Returns: Time of the event, in seconds, since the start of the song.  Unlike
+ *   #SmfEvent.time_seconds, this is right even with lazy seconds (see smf_file_set_lazy_seconds())
+ *   if the tempo map changed since the event was obtained.
+ *
+ * Since: 1.4
+ */
+double
+smf_event_get_time_seconds(smf_event_t *event)
+{
+	maybe_update_time_seconds(event);
+
+	return (event->time_seconds);
+}
+
+/**
+ * smf_file_set_lazy_seconds:
+ * @smf: the SMF
+ * @lazy_seconds: nonzero to compute ->time_seconds of the events only when needed
+ *
+ * Normally, every change to the tempo map recomputes ->time_seconds of all the events
+ * after it.  With lazy seconds, this is not done; instead, ->time_seconds of an event gets
+ * recomputed, if needed, when the event is returned by libsmf, e.g. by smf_file_get_next_event()
+ * or smf_track_get_event_by_number(), or passed to smf_event_get_time_seconds().  Adding or
+ * removing a single tempo change or time signature then takes time proportional to the number
+ * of tempo changes, not to the number of events.  Compacted tracks (see smf_track_compact()) do
+ * not store ->time_seconds at all in this mode, saving 8 bytes per event.
+ *
+ * Returns: 0 if everything went ok, nonzero otherwise.
+ *
+ * Since: 1.4
+ */
+int
+smf_file_set_lazy_seconds(smf_t *smf, int lazy_seconds)
+{
+	int i;
+	smf_track_t *track;
+
+	lazy_seconds = !!lazy_seconds;
+
+	if (smf->lazy_seconds == lazy_seconds)
+		return (0);
+
+	/* Compacted tracks need their ->time_seconds columns back; allocate them before changing anything. */
+	for (i = 1; i <= smf->number_of_tracks && !lazy_seconds; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i - 1);
+
+		if (track->columns == NULL || track->columns->time_seconds != NULL || track->number_of_events == 0)
+			continue;
+
+		track->columns->time_seconds = malloc(track->number_of_events * sizeof(double));
+		if (track->columns->time_seconds == NULL) {
+			g_critical("Cannot allocate ->time_seconds column.");
+			return (-1);
+		}
+	}
+
+	smf->lazy_seconds = lazy_seconds;
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i - 1);
+
+		if (!lazy_seconds) {
+			smf_track_compute_seconds(track);
+		} else if (track->columns != NULL) {
+			free(track->columns->time_seconds);
+			track->columns->time_seconds = NULL;
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Internal:
+ *
+ * Computes ->time_seconds of all the events in the track from their ->time_pulses, using the tempo
+ * map as it is.
+ */
+void
+smf_track_compute_seconds(smf_track_t *track)
+{
+	int i, tempo_number = 0;
+	double seconds;
+	smf_event_t *event;
+
+	assert(track->smf != NULL);
+
+	/* Compacted track; columns are up to date, events already created have to be too. */
+	if (track->columns != NULL) {
+		for (i = 0; i < track->number_of_events; i++) {
+			seconds = seconds_from_pulses_walking(track->smf, track->columns->time_pulses[i], &tempo_number);
+
+			/* No ->time_seconds column with lazy seconds. */
+			if (track->columns->time_seconds != NULL)
+				track->columns->time_seconds[i] = seconds;
+
+			event = g_ptr_array_index(track->events_array, i);
+			if (event != NULL) {
+				event->time_seconds = seconds;
+				event->seconds_generation = track->smf->tempo_generation;
+			}
+		}
+
+		return;
+	}
+
+	for (i = 0; i < track->number_of_events; i++) {
+		event = smf_track_event_at(track, i);
+		event->time_seconds = seconds_from_pulses_walking(track->smf, event->time_pulses, &tempo_number);
+		event->seconds_generation = track->smf->tempo_generation;
+	}
+}
+
 /**
  * smf_file_get_tempo_by_number:
  * @smf: the SMF
@@ -314,8 +755,7 @@ smf_file_get_tempo_by_number(const smf_t *smf, int number)
 smf_tempo_t *
 smf_file_get_tempo_by_pulses(const smf_t *smf, int pulses)
 {
-	int i;
-	smf_tempo_t *tempo;
+	int tempo_number;
 
 	assert(pulses >= 0);
 
@@ -323,16 +763,12 @@ smf_file_get_tempo_by_pulses(const smf_t *smf, int pulses)
 		return (smf_get_tempo_by_number(smf, 0));
 
 	assert(smf->tempo_array != NULL);
-	
-	for (i = smf->tempo_array->len - 1; i >= 0; i--) {
-		tempo = smf_get_tempo_by_number(smf, i);
 
-		assert(tempo);
-		if (tempo->time_pulses < pulses)
-			return (tempo);
-	}
+	tempo_number = tempo_number_before_pulses(smf, pulses);
+	if (tempo_number < 0)
+		return (NULL);
 
-	return (NULL);
+	return (smf_file_get_tempo_by_number(smf, tempo_number));
 }
 
 /**
@@ -345,8 +781,7 @@ smf_file_get_tempo_by_pulses(const smf_t *smf, int pulses)
 smf_tempo_t *
 smf_file_get_tempo_by_seconds(const smf_t *smf, double seconds)
 {
-	int i;
-	smf_tempo_t *tempo;
+	int low, high, middle;
 
 	assert(seconds >= 0.0);
 
@@ -354,18 +789,24 @@ smf_file_get_tempo_by_seconds(const smf_t *smf, double seconds)
 		return (smf_get_tempo_by_number(smf, 0));
 
 	assert(smf->tempo_array != NULL);
-	
-	for (i = smf->tempo_array->len - 1; i >= 0; i--) {
-		tempo = smf_get_tempo_by_number(smf, i);
 
-		assert(tempo);
-		if (tempo->time_seconds < seconds)
-			return (tempo);
+	low = 0;
+	high = smf->tempo_array->len;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+
+		if (((smf_tempo_t *)g_ptr_array_index(smf->tempo_array, middle))->time_seconds < seconds)
+			low = middle + 1;
+		else
+			high = middle;
 	}
 
-	return (NULL);
-}
+	if (low == 0)
+		return (NULL);
 
+	return (smf_file_get_tempo_by_number(smf, low - 1));
+}
 
 /**
  * smf_file_get_last_tempo:
@@ -396,6 +837,37 @@ void
 smf_file_fini_tempo(smf_t *smf)
 {
 	g_ptr_array_set_size(smf->tempo_array, 0);
+	smf->tempo_generation++;
+}
+
+/*
+ * Internal:
+ *
+ * Replaces the tempo map with a copy of the one of "source", as it is, without looking at any events.
+ * Returns 0 if everything went ok.
+ */
+int
+smf_file_copy_tempo_map(smf_t *smf, const smf_t *source)
+{
+	int i;
+	smf_tempo_t *tempo;
+
+	smf_file_fini_tempo(smf);
+
+	for (i = 0; i < source->tempo_array->len; i++) {
+		tempo = malloc(sizeof(smf_tempo_t));
+		if (tempo == NULL) {
+			g_critical("Cannot allocate smf_tempo_t.");
+			return (-1);
+		}
+
+		memcpy(tempo, g_ptr_array_index(source->tempo_array, i), sizeof(smf_tempo_t));
+		tempo->ref_count = 1;
+
+		g_ptr_array_add(smf->tempo_array, tempo);
+	}
+
+	return (0);
 }
 
 /**
@@ -506,3 +978,72 @@ smf_track_add_event_seconds(smf_track_t *track, smf_event_t *event, double secon
 	smf_track_add_event(track, event);
 }
 
+/**
+ * smf_track_add_events_pulses:
+ * @track: the track
+ * @events: (array length=number_of_events): the events to add
+ * @pulses: (array length=number_of_events): times of the events from start of song in pulses
+ * @number_of_events: number of events to add
+ *
+ * Adds events to the track, each one at the time given by the corresponding element of @pulses.
+ * Result is the same as calling smf_track_add_event_pulses() for every event, in order of
+ * @pulses, but it's much faster for large numbers of events: they are sorted once, merged into
+ * the track in a single pass and the tempo map is rebuilt at most once.  The events don't need to be
+ * sorted; events with the same time end up in the order they are in @events.
+ *
+ * Since: 1.4
+ */
+void
+smf_track_add_events_pulses(smf_track_t *track, smf_event_t **events, const int *pulses, int number_of_events)
+{
+	int i;
+
+	assert(number_of_events >= 0);
+	assert(track->smf != NULL);
+
+	for (i = 0; i < number_of_events; i++) {
+		assert(pulses[i] >= 0);
+		assert(events[i]->time_pulses == -1);
+		assert(events[i]->time_seconds == -1.0);
+
+		events[i]->time_pulses = pulses[i];
+	}
+
+	smf_track_add_events(track, events, number_of_events, 1);
+}
+
+/**
+ * smf_track_add_events_seconds:
+ * @track: the track
+ * @events: (array length=number_of_events): the events to add
+ * @seconds: (array length=number_of_events): times of the events from start of song in seconds
+ * @number_of_events: number of events to add
+ *
+ * Adds events to the track, each one at the time given by the corresponding element of @seconds.
+ * Like smf_track_add_events_pulses(), but with times given in seconds.  These are converted to
+ * pulses using the tempo map as it is before the call, so tempo changes among @events don't
+ * affect times of the other events.  If such a tempo change ends up in the middle of the song,
+ * ->time_seconds of all the events get recomputed from the new tempo map afterwards.
+ *
+ * Since: 1.4
+ */
+void
+smf_track_add_events_seconds(smf_track_t *track, smf_event_t **events, const double *seconds, int number_of_events)
+{
+	int i;
+
+	assert(number_of_events >= 0);
+	assert(track->smf != NULL);
+
+	for (i = 0; i < number_of_events; i++) {
+		assert(seconds[i] >= 0.0);
+		assert(events[i]->time_pulses == -1);
+		assert(events[i]->time_seconds == -1.0);
+
+		events[i]->time_seconds = seconds[i];
+		events[i]->time_pulses = pulses_from_seconds(track->smf, seconds[i]);
+	}
+
+	smf_track_add_events(track, events, number_of_events, 0);
+}
+
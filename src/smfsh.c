@@ -367,8 +367,8 @@ show_event(smf_event_t *event)
 			off += snprintf(decoded + off, BUFFER_SIZE - off, " 0x%x", event->midi_buffer[i]);
 	}
 
-	g_message("%d: %s: %s, %f seconds, %d pulses, %d delta pulses", event->event_number, type, decoded,
-	    event->time_seconds, event->time_pulses, event->delta_time_pulses);
+	g_message("%d: %s: %s, %f seconds, %d pulses, %d delta pulses", smf_event_get_event_number(event), type, decoded,
+	    event->time_seconds, event->time_pulses, smf_event_get_delta_time_pulses(event));
 
 	free(decoded);
 
@@ -419,7 +419,7 @@ parse_event_number(const char *arg)
 			g_message("No event currently selected and no event number given.");
 			return (-1);
 		} else {
-			return (selected_event->event_number);
+			return (smf_event_get_event_number(selected_event));
 		}
 	}
 
@@ -450,7 +450,7 @@ cmd_event(char *arg)
 		if (selected_event == NULL) {
 			g_message("No event currently selected.");
 		} else {
-			g_message("Currently selected is event %d, track %d.", selected_event->event_number, selected_track->track_number);
+			g_message("Currently selected is event %d, track %d.", smf_event_get_event_number(selected_event), selected_track->track_number);
 			show_event(selected_event);
 		}
 	} else {
@@ -707,7 +707,7 @@ cmd_eventrm(char *number)
 	if (num < 0)
 		return (-1);
 
-	if (selected_event != NULL && num == selected_event->event_number)
+	if (selected_event != NULL && num == smf_event_get_event_number(selected_event))
 		selected_event = NULL;
 
 	smf_event_delete(smf_track_get_event_by_number(selected_track, num));
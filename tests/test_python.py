@@ -1,8 +1,9 @@
+import gc
 import os
 import unittest
 import tempfile
 
-from gi.repository import Smf
+from gi.repository import GLib, Gio, Smf
 
 
 class Test(unittest.TestCase):
@@ -42,11 +43,11 @@ class Test(unittest.TestCase):
                 self.assertEqual(tracka, eventa.track)
                 self.assertEqual(trackb, eventb.track)
 
-                self.assertEqual(eventa.event_number, eventb.event_number)
-                self.assertEqual(eventa.delta_time_pulses, eventb.delta_time_pulses)
+                self.assertEqual(eventa.get_event_number(), eventb.get_event_number())
+                self.assertEqual(eventa.get_delta_time_pulses(), eventb.get_delta_time_pulses())
                 self.assertEqual(eventa.time_pulses, eventb.time_pulses)
                 self.assertEqual(eventa.time_seconds, eventb.time_seconds)
-                self.assertEqual(eventa.track_number, eventb.track_number)
+                self.assertEqual(eventa.get_track_number(), eventb.get_track_number())
                 self.assertEqual(eventa.midi_buffer_length, eventb.midi_buffer_length)
                 self.assertEqual(eventa.get_buffer(), eventb.get_buffer())
 
@@ -70,6 +71,491 @@ class Test(unittest.TestCase):
         new = Smf.File.load(temp_filename)
         self.compare_smf_files(orig, new)
 
+    def test_bach_async_load_save_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        loop = GLib.MainLoop()
+        results = []
+
+        def finish(finish_func, source, result):
+            results.append(finish_func(result))
+            loop.quit()
+
+        Smf.File.load_async(path, None, finish, Smf.File.load_finish)
+        loop.run()
+        self.compare_smf_files(orig, results[-1])
+
+        handle, temp_filename = tempfile.mkstemp('mid')
+        os.close(handle)
+        Smf.File.save_async(results[-1], temp_filename, None, finish, Smf.File.save_finish)
+        loop.run()
+        self.assertTrue(results[-1])
+        self.compare_smf_files(orig, Smf.File.load(temp_filename))
+        os.unlink(temp_filename)
+
+        cancellable = Gio.Cancellable()
+        cancellable.cancel()
+        Smf.File.load_async(path, cancellable, lambda source, result: (results.append(result), loop.quit()))
+        loop.run()
+        with self.assertRaises(GLib.Error):
+            Smf.File.load_finish(results[-1])
+
+    def test_bach_load_many_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        loaded = []
+
+        def finished(file_name, smf, error, user_data):
+            loaded.append((file_name, smf))
+
+        count = Smf.File.load_many([path, path + '.missing', path], 2, 0, finished, None)
+        self.assertEqual(count, 2)
+        self.assertEqual(len(loaded), 3)
+        for file_name, smf in loaded:
+            if file_name == path:
+                self.compare_smf_files(orig, smf)
+            else:
+                self.assertIsNone(smf)
+
+    @unittest.skipUnless(os.path.isdir('/proc/self/fd'), 'needs /proc/self/fd')
+    def test_load_many_closes_files(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        names = [path, path + '.missing'] * 50
+        open_files = len(os.listdir('/proc/self/fd'))
+        count = Smf.File.load_many(names, 4, 0, lambda *args: None, None)
+        self.assertEqual(count, 50)
+        self.assertEqual(len(os.listdir('/proc/self/fd')), open_files)
+
+    def test_bach_compact_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        compact = Smf.File.load(path)
+        self.assertEqual(compact.compact(), 0)
+
+        track = compact.get_track_by_number(2)
+        self.assertIsNone(track.events_array[10])
+        self.assertEqual(compact.get_length_pulses(), orig.get_length_pulses())
+
+        orig.seek_to_seconds(100.0)
+        compact.seek_to_seconds(100.0)
+        self.assertEqual(compact.peek_next_event().time_pulses, orig.peek_next_event().time_pulses)
+
+        # Creates all the events, so that events_array can be compared directly.
+        for track in compact.tracks_array:
+            for i in range(track.number_of_events):
+                track.get_event_by_number(i + 1)
+        self.compare_smf_files(orig, compact)
+
+    def test_bach_compact_save(self):
+        compact = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        self.assertEqual(compact.compact(), 0)
+        with tempfile.NamedTemporaryFile(suffix='.mid') as f:
+            self.assertEqual(compact.save(f.name), 0)
+            saved = Smf.File.load(f.name)
+        # Saving must not create the events of compacted tracks.
+        for track in compact.tracks_array:
+            self.assertTrue(all(event is None for event in track.events_array))
+        for track in compact.tracks_array:
+            for i in range(track.number_of_events):
+                track.get_event_by_number(i + 1)
+        self.compare_smf_files(saved, compact)
+
+    def test_bach_mmap_load_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        mapped = Smf.File.load_mmap(path)
+        self.compare_smf_files(orig, mapped)
+
+    def test_bach_lazy_load_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        lazy = Smf.File.load_lazy(path)
+        self.assertEqual(orig.get_length_pulses(), lazy.get_length_pulses())
+        self.assertEqual(orig.get_length_seconds(), lazy.get_length_seconds())
+
+        # Fields are read directly below, so make sure every track gets parsed first.
+        for i in range(1, lazy.number_of_tracks + 1):
+            lazy.get_track_by_number(i)
+        self.compare_smf_files(orig, lazy)
+
+        self.assertEqual(lazy.evict_untouched_tracks(), 0)
+        self.assertEqual(lazy.evict_untouched_tracks(), lazy.number_of_tracks)
+        for i in range(1, lazy.number_of_tracks + 1):
+            lazy.get_track_by_number(i)
+        self.compare_smf_files(orig, lazy)
+
+    def test_bach_parallel_load_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        for threads in (0, 1, 4):
+            self.compare_smf_files(orig, Smf.File.load_parallel(path, threads))
+
+    def test_bach_probe_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        probe = Smf.File.probe(path)
+        self.assertEqual(probe.format, orig.format)
+        self.assertEqual(probe.ppqn, orig.ppqn)
+        self.assertEqual(probe.number_of_tracks, orig.number_of_tracks)
+        self.assertEqual(probe.length_pulses, orig.get_length_pulses())
+        self.assertEqual(probe.length_seconds, orig.get_length_seconds())
+        self.assertEqual(len(probe.track_names), orig.number_of_tracks)
+        self.assertEqual(probe.track_names[1], 'Piano right')
+
+    def test_bach_parser_feed_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        with open(path, 'rb') as f:
+            data = f.read()
+
+        events = []
+        parser = Smf.Parser.new()
+        parser.set_event_func(events.append)
+        for i in range(0, len(data), 1000):
+            self.assertEqual(parser.feed(data[i:i + 1000]), 0)
+        new = parser.finish()
+
+        self.assertEqual(len(events), sum(t.number_of_events for t in orig.tracks_array))
+        self.compare_smf_files(orig, new)
+
+    def test_tempo_in_later_track_load(self):
+        smf = Smf.File.new()
+        notes = Smf.Track.new()
+        tempos = Smf.Track.new()
+        smf.add_track(notes)
+        smf.add_track(tempos)
+
+        for i in range(100):
+            notes.add_event_pulses(Smf.Event.new_from_bytes(0x90, 60, 100), i * 50)
+        for i in range(10):
+            tempo = Smf.Event.new_from_pointer([0xFF, 0x51, 0x03, 0x07, i * 8, 0x20])
+            tempos.add_event_pulses(tempo, 100 + i * 400)
+
+        handle, temp_filename = tempfile.mkstemp('mid')
+        os.close(handle)
+        self.assertEqual(smf.save(temp_filename), 0)
+        new = Smf.File.load(temp_filename)
+        os.unlink(temp_filename)
+
+        self.assertEqual(len(smf.tempo_array), len(new.tempo_array))
+        for i in range(smf.number_of_tracks):
+            eventsa = smf.tracks_array[i].events_array
+            eventsb = new.tracks_array[i].events_array
+            self.assertEqual([e.time_seconds for e in eventsa[:len(eventsb) - 1]],
+                             [e.time_seconds for e in eventsb[:-1]])
+
+    def test_add_event_seconds_with_tempo_changes(self):
+        smf = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        self.assertGreater(len(smf.tempo_array), 1)
+        track = smf.get_track_by_number(2)
+        event = Smf.Event.new_from_bytes(0x90, 60, 100)
+        track.add_event_seconds(event, 100.0)
+
+        self.assertAlmostEqual(event.time_seconds, 100.0)
+        tempo = smf.get_tempo_by_seconds(100.0)
+        self.assertLessEqual(tempo.time_seconds, 100.0)
+        self.assertLessEqual(tempo.time_pulses, event.time_pulses)
+        number = event.get_event_number()
+        self.assertLessEqual(track.get_event_by_number(number - 1).time_pulses, event.time_pulses)
+        self.assertGreater(track.get_event_by_number(number + 1).time_pulses, event.time_pulses)
+
+    def test_add_event_at_shared_time(self):
+        smf = Smf.File.new()
+        track = Smf.Track.new()
+        smf.add_track(track)
+        for pulses in (0, 100, 100, 200):
+            track.add_event_pulses(Smf.Event.new_from_bytes(0x90, 60, 100), pulses)
+        last = track.get_event_by_number(4)
+
+        # Goes after the events that happen at the same time.
+        event = Smf.Event.new_from_bytes(0x80, 60, 0)
+        track.add_event_pulses(event, 100)
+
+        self.assertEqual([e.time_pulses for e in track.events_array], [0, 100, 100, 100, 200])
+        self.assertEqual(track.get_event_by_number(4), event)
+        self.assertEqual(event.get_event_number(), 4)
+        self.assertEqual(event.get_delta_time_pulses(), 0)
+        self.assertEqual(last.get_event_number(), 5)
+        self.assertEqual(last.get_delta_time_pulses(), 100)
+        self.assertEqual([track.get_event_by_number(i).get_event_number() for i in range(1, 6)],
+                         [1, 2, 3, 4, 5])
+
+    def test_add_events_compare(self):
+        one_by_one = Smf.File.new()
+        bulk = Smf.File.new()
+        for smf in (one_by_one, bulk):
+            smf.add_track(Smf.Track.new())
+
+        pulses = [(i * 7919) % 1000 for i in range(200)]
+        order = sorted(range(len(pulses)), key=lambda i: pulses[i])
+        for i in order:
+            one_by_one.get_track_by_number(1).add_event_pulses(Smf.Event.new_from_bytes(0x90, i % 128, 100), pulses[i])
+        events = [Smf.Event.new_from_bytes(0x90, i % 128, 100) for i in range(len(pulses))]
+        bulk.get_track_by_number(1).add_events_pulses(events, pulses)
+
+        self.compare_smf_files(one_by_one, bulk)
+
+    def test_remove_events_if_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        one_by_one = Smf.File.load(path)
+        bulk = Smf.File.load(path)
+
+        def is_quiet_note(event, user_data):
+            return event.get_buffer()[0] & 0xF0 == 0x90 and event.get_buffer()[2] < 60
+
+        removed = 0
+        for track in one_by_one.tracks_array:
+            for i in range(track.number_of_events, 0, -1):
+                event = track.get_event_by_number(i)
+                if is_quiet_note(event, None):
+                    track.remove_event(event)
+                    removed += 1
+
+        self.assertGreater(removed, 0)
+        self.assertEqual(bulk.remove_events_if(is_quiet_note, None), removed)
+        self.compare_smf_files(one_by_one, bulk)
+
+    def test_remove_events_if_event_number(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        smf = Smf.File.load(path)
+        reference = Smf.File.load(path)
+
+        track = smf.get_track_by_number(2)
+        reference_track = reference.get_track_by_number(2)
+        track.remove_event(track.get_event_by_number(5))
+        reference_track.remove_event(reference_track.get_event_by_number(5))
+
+        seen = []
+
+        def is_even(event, user_data):
+            seen.append(event.get_event_number())
+            return event.get_event_number() % 2 == 0
+
+        number_of_events = track.number_of_events
+        self.assertEqual(track.remove_events_if(is_even, None), number_of_events // 2)
+        self.assertEqual(seen, list(range(1, number_of_events + 1)))
+
+        for i in range(1, track.number_of_events + 1):
+            self.assertEqual(track.get_event_by_number(i).time_pulses,
+                             reference_track.get_event_by_number(2 * i - 1).time_pulses)
+
+    def test_event_fields_refreshed(self):
+        smf = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        track = smf.get_track_by_number(2)
+        event = track.get_event_by_number(10)
+        track.remove_event(track.get_event_by_number(5))
+
+        self.assertEqual(event.get_event_number(), 9)
+        self.assertEqual(track.get_event_by_number(9).event_number, 9)
+
+        seen = []
+
+        def record_fields(event, user_data):
+            seen.append((event.event_number, event.track_number, event.delta_time_pulses))
+            return False
+
+        track.remove_event(track.get_event_by_number(5))
+        self.assertEqual(track.remove_events_if(record_fields, None), 0)
+        self.assertEqual(seen, [(e.get_event_number(), e.get_track_number(), e.get_delta_time_pulses())
+                                for e in track.events_array])
+
+    def test_edit_transaction_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        immediate = Smf.File.load(path)
+        batched = Smf.File.load(path)
+
+        batched.begin_edit()
+        for smf in (immediate, batched):
+            track = smf.get_track_by_number(1)
+            for i in range(20):
+                tempo = Smf.Event.new_from_pointer([0xFF, 0x51, 0x03, 0x07, i * 8, 0x20])
+                track.add_event_pulses(tempo, 1000 + i * 997)
+        batched.end_edit()
+
+        self.assertEqual([t.time_seconds for t in immediate.tempo_array],
+                         [t.time_seconds for t in batched.tempo_array])
+        self.compare_smf_files(immediate, batched)
+
+    def test_edit_transaction_insert_remove_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        immediate = Smf.File.load(path)
+        batched = Smf.File.load(path)
+
+        batched.begin_edit()
+        for smf in (immediate, batched):
+            track = smf.get_track_by_number(2)
+            for i in range(200):
+                track.add_event_pulses(Smf.Event.new_from_bytes(0x90, i % 128, 64), 5000 + i * 7)
+                if i % 3 == 0:
+                    track.remove_event(track.get_event_by_number(100 + i))
+            self.assertEqual(track.get_event_by_number(150).get_event_number(), 150)
+        self.assertEqual([e.time_pulses for e in immediate.get_track_by_number(2).events_array],
+                         [batched.get_track_by_number(2).get_event_by_number(i).time_pulses
+                          for i in range(1, batched.get_track_by_number(2).number_of_events + 1)])
+        batched.end_edit()
+
+        self.assertEqual(len(batched.get_track_by_number(2).events_array),
+                         batched.get_track_by_number(2).number_of_events)
+        self.compare_smf_files(immediate, batched)
+
+    def test_tempo_edit_late_in_song_compare(self):
+        edited = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        length = edited.get_length_pulses()
+        track = edited.get_track_by_number(1)
+        track.add_event_pulses(Smf.Event.new_from_pointer([0xFF, 0x51, 0x03, 0x03, 0x00, 0x00]), length - 2000)
+        track.add_event_pulses(Smf.Event.new_from_pointer([0xFF, 0x58, 0x04, 0x03, 0x02, 0x18, 0x08]), length - 1000)
+
+        handle, temp_filename = tempfile.mkstemp('mid')
+        os.close(handle)
+        self.assertEqual(edited.save(temp_filename), 0)
+        new = Smf.File.load(temp_filename)
+        os.unlink(temp_filename)
+
+        self.assertEqual([t.time_seconds for t in edited.tempo_array],
+                         [t.time_seconds for t in new.tempo_array])
+        self.compare_smf_files(edited, new)
+
+    def test_lazy_seconds_compare(self):
+        eager = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        lazy = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        self.assertEqual(lazy.set_lazy_seconds(1), 0)
+        events = [lazy.get_track_by_number(2).get_event_by_number(i) for i in (1, 100, 1000)]
+
+        for smf in (eager, lazy):
+            track = smf.get_track_by_number(1)
+            event = Smf.Event.new_from_pointer([0xFF, 0x51, 0x03, 0x03, 0x00, 0x00])
+            track.add_event_pulses(event, 1000)
+            track.add_event_pulses(Smf.Event.new_from_pointer([0xFF, 0x51, 0x03, 0x0A, 0x00, 0x00]), 20000)
+            track.remove_event(event)
+
+        self.assertEqual(len(eager.tempo_array), len(lazy.tempo_array))
+        for a, b in zip(eager.tempo_array, lazy.tempo_array):
+            self.assertAlmostEqual(a.time_seconds, b.time_seconds)
+        for event in events:
+            self.assertAlmostEqual(event.get_time_seconds(),
+                                   eager.get_track_by_number(2).get_event_by_number(event.get_event_number()).time_seconds)
+        self.assertEqual(lazy.set_lazy_seconds(0), 0)
+        self.compare_smf_files(eager, lazy)
+
+    def test_length_after_edits(self):
+        smf = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+
+        def length():
+            return max([t.get_last_event().time_pulses for t in smf.tracks_array if t.number_of_events > 0] + [0])
+
+        self.assertEqual(smf.get_length_pulses(), length())
+        for track in smf.tracks_array:
+            track.remove_event(track.get_last_event())
+            self.assertEqual(smf.get_length_pulses(), length())
+        track = smf.get_track_by_number(3)
+        track.add_event_pulses(Smf.Event.new_from_bytes(0x90, 0x3C, 0x40), length() + 100)
+        self.assertEqual(smf.get_length_pulses(), length())
+        self.assertTrue(track.get_last_event().is_last())
+        smf.remove_track(track)
+        self.assertEqual(smf.get_length_pulses(), length())
+
+    def test_recycled_events_are_clean(self):
+        events = [Smf.Event.new_from_pointer([0xF0, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0xF7])
+                  for i in range(100)]
+        del events
+        gc.collect()
+        for i in range(100):
+            event = Smf.Event.new_from_bytes(0x90, 0x3C, 0x40)
+            self.assertEqual(list(event.get_buffer()), [0x90, 0x3C, 0x40])
+            self.assertEqual(event.time_pulses, -1)
+            self.assertIsNone(event.track)
+        Smf.trim_event_cache(0)
+
+    def test_clone_compare(self):
+        orig = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        clone = orig.clone()
+        self.compare_smf_files(orig, clone)
+
+        clone.get_track_by_number(1).add_event_pulses(Smf.Event.new_from_pointer([0xFF, 0x51, 0x03, 0x03, 0x00, 0x00]), 100)
+        clone.get_track_by_number(2).remove_event(clone.get_track_by_number(2).get_event_by_number(5))
+        self.compare_smf_files(orig, Smf.File.load(os.path.join(self.path, 'chpn_op53.mid')))
+
+    def test_track_clone_compare(self):
+        orig = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        new = Smf.File.new()
+        self.assertEqual(new.set_ppqn(orig.ppqn), 0)
+        for track in orig.tracks_array:
+            new.add_track(track.clone())
+        self.assertEqual([t.time_seconds for t in orig.tempo_array],
+                         [t.time_seconds for t in new.tempo_array])
+        self.compare_smf_files(orig, new)
+
+    def test_next_event_merge_order(self):
+        smf = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        expected = sorted((track.get_event_by_number(i).time_pulses, track.track_number, i)
+                          for track in smf.tracks_array
+                          for i in range(1, track.number_of_events + 1))
+
+        def play():
+            played = []
+            event = smf.get_next_event()
+            while event is not None:
+                played.append((event.time_pulses, event.get_track_number(), event.get_event_number()))
+                event = smf.get_next_event()
+            return played
+
+        smf.rewind()
+        self.assertEqual(play(), expected)
+        smf.rewind()
+        self.assertEqual(smf.get_track_by_number(2).get_next_event().get_event_number(), 1)
+        self.assertEqual(play(), [e for e in expected if e[1:] != (2, 1)])
+
+    def test_timeline_index_compare(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        orig = Smf.File.load(path)
+        smf = Smf.File.load(path)
+        self.assertEqual(smf.set_timeline_index(1), 0)
+
+        def play(smf):
+            played = []
+            event = smf.get_next_event()
+            while event is not None:
+                played.append((event.time_pulses, event.time_seconds, event.get_track_number(),
+                               event.get_event_number()))
+                event = smf.get_next_event()
+            return played
+
+        orig.rewind()
+        smf.rewind()
+        self.assertEqual(play(smf), play(orig))
+        smf.rewind()
+        self.assertEqual(play(smf), play(orig))
+        self.assertEqual(smf.seek_to_event(smf.get_track_by_number(2).get_event_by_number(100)), 0)
+        self.assertEqual(orig.seek_to_event(orig.get_track_by_number(2).get_event_by_number(100)), 0)
+        self.assertEqual(play(smf), play(orig))
+        for f in (smf, orig):
+            f.get_track_by_number(1).add_event_pulses(Smf.Event.new_from_bytes(0x90, 60, 100), 1000)
+            self.assertEqual(f.seek_to_pulses(500), 0)
+        self.assertEqual(play(smf), play(orig))
+
+    def test_event_outlives_file(self):
+        path = os.path.join(self.path, 'chpn_op53.mid')
+        smf = Smf.File.load(path)
+        event = smf.get_track_by_number(2).get_event_by_number(10)
+        buf = event.get_buffer()
+        del smf
+        gc.collect()
+        self.assertEqual(event.get_buffer(), buf)
+
+    def test_event_accessors_after_removal(self):
+        smf = Smf.File.load(os.path.join(self.path, 'chpn_op53.mid'))
+        track = smf.get_track_by_number(2)
+        event = track.get_event_by_number(10)
+        previous = track.get_event_by_number(9)
+        track.remove_event(track.get_event_by_number(5))
+        self.assertEqual(event.get_event_number(), 9)
+        track.remove_event(previous)
+        self.assertEqual(event.get_event_number(), 8)
+        self.assertEqual(event.get_delta_time_pulses(),
+                         event.time_pulses - track.get_event_by_number(7).time_pulses)
+        smf.remove_track(smf.get_track_by_number(1))
+        self.assertEqual(event.get_track_number(), 1)
+
 
 if __name__ == '__main__':
     unittest.main()